@@ -0,0 +1,33 @@
+import json
+
+# Loader for the JSON-lines results store written by `multiplication --results=FILE`
+# (script.sh appends to src/results.jsonl). Each line is one run with every CSV
+# column plus its metadata (Mode, Parallel_flag, Block, Threads, Compiler, Build_flags,
+# CPU_model, Host, Timestamp), so plots can select runs instead of walking test_*/ trees.
+#
+#   from results_store import load_results, series
+#   runs = load_results('../src/results.jsonl', Mode='block', Block='256x256x256')
+#   x, y = series(runs, 'Matrix Size', 'GFLOPS')
+
+
+def load_results(path, **filters):
+    """Returns the runs in path whose fields equal every keyword filter."""
+    runs = []
+    with open(path) as store:
+        for line in store:
+            line = line.strip()
+            if not line:
+                continue
+            run = json.loads(line)
+            if all(run.get(key) == value for key, value in filters.items()):
+                runs.append(run)
+    return runs
+
+
+def series(runs, x, y):
+    """Returns (xs, ys) sorted by x; when a point was run several times the latest run wins."""
+    latest = {}
+    for run in sorted(runs, key=lambda r: r.get('Timestamp', '')):
+        latest[run[x]] = run[y]
+    xs = sorted(latest)
+    return xs, [latest[v] for v in xs]
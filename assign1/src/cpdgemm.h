@@ -0,0 +1,48 @@
+#ifndef CPD_GEMM_H
+#define CPD_GEMM_H
+
+// Public interface of the matrix multiplication library (libcpdgemm.a and
+// libcpdgemm.so, built by script.sh). All matrices are row-major doubles with
+// leading dimensions (row strides in elements) of at least their row length.
+
+#include <cstdint>
+#include <functional>
+
+// Index and dimension type: products such as i * lda overflow int beyond n = 46340.
+typedef int64_t idx_t;
+
+// C = alpha * A * B + beta * C for an M x K matrix A, a K x N matrix B and an
+// M x N matrix C. With beta = 0 C is only written, so it may hold garbage.
+// Runs the packed kernel of the widest ISA the CPU supports on the worker pool;
+// products below a few hundred thousand multiply-adds stay on the calling thread,
+// and those above gemmSetDeviceThreshold go to the OpenMP offload device.
+// Calls from several threads are serialised; do not call it from gemmForEachWorker.
+void gemm(idx_t M, idx_t N, idx_t K, double alpha, const double *A, idx_t lda,
+          const double *B, idx_t ldb, double beta, double *C, idx_t ldc);
+
+// C[b] = alpha * A[b] * B[b] + beta * C[b] for count independent problems of
+// one shape, each given by its own pointers. The batch is split across the
+// pool workers and every problem runs whole on one worker, with a fixed-size
+// kernel for square sizes 16, 24, 32, 48, 64, 96 and 128.
+void gemmBatched(idx_t count, idx_t M, idx_t N, idx_t K, double alpha, const double *const *A, idx_t lda,
+                 const double *const *B, idx_t ldb, double beta, double *const *C, idx_t ldc);
+
+// Resizes the worker pool to threads workers, the calling thread included
+// (0 means omp_get_max_threads()). The pool is started on the first call of
+// gemm otherwise and its threads then stay alive, waiting for the next call.
+void gemmSetThreads(int threads);
+int gemmThreads();
+
+// Products of at least work multiply-adds (M * N * K, default 2^30) run on the
+// default OpenMP offload device, transfers included, when the program was built
+// with an offload target and a device is present. 0 keeps all of them on the host.
+void gemmSetDeviceThreshold(double work);
+// Whether gemm() sends an M x N x K product to the device.
+bool gemmUsesDevice(idx_t M, idx_t N, idx_t K);
+
+// Runs fn(worker) once on every worker of the pool, the caller as worker 0,
+// and returns when all are done; e.g. to set up per-thread state such as
+// hardware counters on the threads that gemm will use.
+void gemmForEachWorker(const std::function<void(int)> &fn);
+
+#endif
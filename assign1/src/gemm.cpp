@@ -0,0 +1,251 @@
+#include "kernels.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Persistent worker pool behind gemm(). Workers 1..n-1 are OS threads that live
+// as long as the pool; the calling thread is worker 0. A call publishes a job
+// and bumps the generation counter; workers spin on it for POOL_SPIN rounds
+// before sleeping on the condition variable, so back-to-back small calls are
+// picked up without a futex wake-up or an OpenMP fork/join.
+#define POOL_SPIN 4000
+// Products with fewer multiply-adds than this run on the calling thread alone.
+#define POOL_MIN_WORK (64 * 64 * 64)
+// Default gemmSetDeviceThreshold: 1024^3 multiply-adds, where the transfers
+// of the three matrices are a small share of the host's compute time.
+#define GEMM_DEVICE_MIN_WORK (1024.0 * 1024 * 1024)
+
+inline void cpuRelax() {
+#ifdef CPD_X86
+    _mm_pause();
+#endif
+}
+
+struct WorkerPool {
+    vector<thread> threads;
+    mutex lock;
+    condition_variable wake, finished;
+    const function<void(int)> *job = nullptr;
+    atomic<unsigned> generation{0};
+    atomic<int> pending{0};
+    atomic<bool> stopping{false};
+    int sleepers = 0;
+    // Packing buffers of each worker, allocated by the worker on first use.
+    vector<double *> Ap, Bp;
+
+    ~WorkerPool() { stop(); }
+
+    // seen is the generation at start, so a new worker does not rerun the last job.
+    void workerLoop(int id, unsigned seen) {
+        for (;;) {
+            for (int spin = 0; spin < POOL_SPIN && generation.load(memory_order_acquire) == seen; spin++) cpuRelax();
+            if (generation.load(memory_order_acquire) == seen) {
+                unique_lock<mutex> guard(lock);
+                sleepers++;
+                wake.wait(guard, [&] { return generation.load(memory_order_acquire) != seen; });
+                sleepers--;
+            }
+            if (stopping.load()) return;
+            seen = generation.load(memory_order_acquire);
+            (*job)(id);
+            if (pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+                lock_guard<mutex> guard(lock);
+                finished.notify_one();
+            }
+        }
+    }
+
+    void start(int n) {
+        stop();
+        stopping = false;
+        Ap.assign(n, nullptr);
+        Bp.assign(n, nullptr);
+        for (int id = 1; id < n; id++) threads.emplace_back(&WorkerPool::workerLoop, this, id, generation.load());
+    }
+
+    void stop() {
+        if (!threads.empty()) {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+                generation.fetch_add(1, memory_order_release);
+                wake.notify_all();
+            }
+            for (thread &t : threads) t.join();
+            threads.clear();
+        }
+        for (double *p : Ap) freeMatrix(p);
+        for (double *p : Bp) freeMatrix(p);
+        Ap.clear();
+        Bp.clear();
+    }
+
+    int size() const { return threads.size() + 1; }
+
+    void run(const function<void(int)> &fn) {
+        if (threads.empty()) {
+            fn(0);
+            return;
+        }
+        job = &fn;
+        pending.store(threads.size(), memory_order_relaxed);
+        {
+            lock_guard<mutex> guard(lock);
+            generation.fetch_add(1, memory_order_release);
+            if (sleepers > 0) wake.notify_all();
+        }
+        fn(0);
+        TRACE_SPAN("barrier");
+        for (int spin = 0; spin < POOL_SPIN && pending.load(memory_order_acquire) > 0; spin++) cpuRelax();
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return pending.load(memory_order_acquire) == 0; });
+    }
+};
+
+WorkerPool pool;
+// Serialises gemm calls and pool resizes; the pool runs one job at a time.
+mutex gemmLock;
+once_flag kernelsOnce;
+double deviceMinWork = GEMM_DEVICE_MIN_WORK;
+
+void ensureKernels() {
+    call_once(kernelsOnce, [] { if (!kernelsSelected) selectKernels("auto"); });
+}
+
+void ensurePool() {
+    ensureKernels();
+    if (pool.Ap.empty()) pool.start(omp_get_max_threads());
+}
+
+// C = beta * C for an m x n block; beta = 0 overwrites without reading C.
+void scaleBlock(idx_t m, idx_t n, double beta, double *C, idx_t ldc) {
+    if (beta == 1.0) return;
+    if (beta == 0.0) {
+        zeroMatrix(m, n, C, ldc);
+        return;
+    }
+    for (idx_t i = 0; i < m; i++) {
+        for (idx_t j = 0; j < n; j++) C[i * ldc + j] *= beta;
+    }
+}
+
+// One worker's block of C through the packed kernel, on its own buffers.
+void packedBlock(idx_t M, idx_t N, idx_t K, double alpha, const double *A, idx_t lda, const double *B, idx_t ldb,
+                 double beta, double *C, idx_t ldc, int worker) {
+    scaleBlock(M, N, beta, C, ldc);
+    if (alpha == 0.0 || K == 0) return;
+
+    double *&Ap = pool.Ap[worker], *&Bp = pool.Bp[worker];
+    if (!Ap) Ap = allocMatrix((GEMM_MC + GEMM_MR_MAX) * GEMM_KC, false);
+    if (!Bp) Bp = allocMatrix(GEMM_KC * (GEMM_NC + GEMM_NR_MAX), false);
+    if (!Ap || !Bp) {
+        cerr << "gemm: cannot allocate the packing buffers." << endl;
+        abort();
+    }
+
+    const idx_t MR = kern.mr, NR = kern.nr;
+    for (idx_t jc = 0; jc < N; jc += GEMM_NC) {
+        idx_t nc = min<idx_t>(GEMM_NC, N - jc);
+        for (idx_t pc = 0; pc < K; pc += GEMM_KC) {
+            idx_t kc = min<idx_t>(GEMM_KC, K - pc);
+            packB(kc, nc, &B[pc * ldb + jc], ldb, Bp, NR);
+            for (idx_t ic = 0; ic < M; ic += GEMM_MC) {
+                idx_t mc = min<idx_t>(GEMM_MC, M - ic);
+                packA(mc, kc, alpha, &A[ic * lda + pc], lda, Ap, MR);
+                TRACE_SPAN("compute");
+                for (idx_t jr = 0; jr < nc; jr += NR) {
+                    for (idx_t ir = 0; ir < mc; ir += MR) {
+                        kern.microKernel(kc, Ap + ir * kc, Bp + jr * kc, &C[(ic + ir) * ldc + jc + jr], ldc,
+                                         min(MR, mc - ir), min(NR, nc - jr));
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool routeToDevice(idx_t M, idx_t N, idx_t K) {
+    return deviceMinWork > 0 && (double)M * N * K >= deviceMinWork && deviceAvailable();
+}
+
+// C is split into a grid of blocks, one per worker: as many row blocks (in
+// multiples of MR) as there are workers and MR rows, then the remaining
+// workers split the columns (in multiples of NR), so short-wide shapes still
+// use every worker. Each worker packs the B panels of its own columns.
+void gemm(idx_t M, idx_t N, idx_t K, double alpha, const double *A, idx_t lda,
+          const double *B, idx_t ldb, double beta, double *C, idx_t ldc) {
+    if (M <= 0 || N <= 0) return;
+    lock_guard<mutex> guard(gemmLock);
+    if (routeToDevice(M, N, K)) {
+        OnMultDevice(M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+        return;
+    }
+    ensurePool();
+
+    int workers = (double)M * N * K < POOL_MIN_WORK ? 1 : pool.size();
+    const idx_t MR = kern.mr, NR = kern.nr;
+    idx_t rowParts = min<idx_t>(workers, (M + MR - 1) / MR);
+    idx_t colParts = max<idx_t>(1, min<idx_t>(workers / rowParts, (N + NR - 1) / NR));
+    idx_t rowStep = ((M + rowParts - 1) / rowParts + MR - 1) / MR * MR;
+    idx_t colStep = ((N + colParts - 1) / colParts + NR - 1) / NR * NR;
+
+    auto block = [&](int w) {
+        idx_t i0 = (w / colParts) * rowStep, j0 = (w % colParts) * colStep;
+        if (w >= rowParts * colParts || i0 >= M || j0 >= N) return;
+        packedBlock(min(rowStep, M - i0), min(colStep, N - j0), K, alpha, &A[i0 * lda], lda, &B[j0], ldb,
+                    beta, &C[i0 * ldc + j0], ldc, w);
+    };
+    if (workers == 1) block(0);
+    else pool.run(block);
+}
+
+// Contiguous ranges of the batch per worker. Below POOL_MIN_WORK in total the
+// batch stays on the calling thread.
+void gemmBatched(idx_t count, idx_t M, idx_t N, idx_t K, double alpha, const double *const *A, idx_t lda,
+                 const double *const *B, idx_t ldb, double beta, double *const *C, idx_t ldc) {
+    if (count <= 0 || M <= 0 || N <= 0) return;
+    lock_guard<mutex> guard(gemmLock);
+    ensurePool();
+
+    SmallKernel fixed = smallKernelFor(M, N, K);
+    idx_t workers = (double)count * M * N * K < POOL_MIN_WORK ? 1 : min<idx_t>(pool.size(), count);
+    auto range = [&](int w) {
+        if (w >= workers) return;
+        for (idx_t b = count * w / workers; b < count * (w + 1) / workers; b++) {
+            if (fixed) fixed(A[b], lda, B[b], ldb, C[b], ldc, alpha, beta);
+            else smallGemm(M, N, K, alpha, A[b], lda, B[b], ldb, beta, C[b], ldc);
+        }
+    };
+    if (workers == 1) range(0);
+    else pool.run(range);
+}
+
+void gemmSetThreads(int threads) {
+    lock_guard<mutex> guard(gemmLock);
+    ensureKernels();
+    pool.start(threads > 0 ? threads : omp_get_max_threads());
+}
+
+int gemmThreads() {
+    lock_guard<mutex> guard(gemmLock);
+    ensurePool();
+    return pool.size();
+}
+
+void gemmSetDeviceThreshold(double work) {
+    lock_guard<mutex> guard(gemmLock);
+    deviceMinWork = work;
+}
+
+bool gemmUsesDevice(idx_t M, idx_t N, idx_t K) {
+    lock_guard<mutex> guard(gemmLock);
+    return routeToDevice(M, N, K);
+}
+
+void gemmForEachWorker(const function<void(int)> &fn) {
+    lock_guard<mutex> guard(gemmLock);
+    ensurePool();
+    pool.run(fn);
+}
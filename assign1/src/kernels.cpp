@@ -0,0 +1,1331 @@
+#include "kernels.h"
+
+#include <chrono>
+#include <iostream>
+#include <future>
+#include <atomic>
+#include <cerrno>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace chrono;
+
+void freeMatrix(void *p) {
+    free(p);
+}
+
+// omp_null_allocator when the OpenMP runtime cannot pin (GCC before 14).
+omp_allocator_handle_t pinnedAllocator() {
+    static const omp_allocator_handle_t allocator = [] {
+        omp_alloctrait_t traits[] = {{omp_atk_pinned, omp_atv_true}, {omp_atk_fallback, omp_atv_null_fb},
+                                     {omp_atk_alignment, CACHE_LINE_BYTES}};
+        return omp_init_allocator(omp_default_mem_space, 3, traits);
+    }();
+    return allocator;
+}
+
+double *allocPinned(size_t count) {
+    size_t bytes = max<size_t>(count, 1) * sizeof(double);
+    if (pinnedAllocator() != omp_null_allocator) return (double *)omp_alloc(bytes, pinnedAllocator());
+    double *p = allocMatrix(count, false);
+    if (p && mlock(p, bytes) != 0) {
+        cerr << "Cannot lock " << bytes / 1048576 << " MB of host memory (raise ulimit -l)." << endl;
+        freeMatrix(p);
+        return nullptr;
+    }
+    return p;
+}
+
+// free() unmaps a large mlock-ed block, which also drops the lock.
+void freePinned(void *p) {
+    if (!p) return;
+    if (pinnedAllocator() != omp_null_allocator) omp_free(p, pinnedAllocator());
+    else freeMatrix(p);
+}
+
+
+// Scalar kernels: plain loops, left to the compiler's auto-vectoriser.
+
+// y[0:n] += a * x[0:n]
+void axpy_scalar(idx_t n, double a, const double *x, double *y) {
+    for (idx_t j = 0; j < n; j++) y[j] += a * x[j];
+}
+
+void axpyf_scalar(idx_t n, float a, const float *x, float *y) {
+    for (idx_t j = 0; j < n; j++) y[j] += a * x[j];
+}
+
+// y[0:n] += a * widen(x[0:n]) with float y
+void axpybf16_scalar(idx_t n, float a, const bf16 *x, float *y) {
+    for (idx_t j = 0; j < n; j++) y[j] += a * widen(x[j]);
+}
+
+// Peak-FLOPS probes: independent multiply-add chains with no memory traffic,
+// enough of them to cover the FMA latency on every pipe. Each returns the
+// number of floating-point operations it ran; the chains' sum goes to *sink
+// so the compiler cannot drop the loop.
+// A constant rather than a #define so that #pragma GCC unroll can take it.
+const int PROBE_CHAINS = 12;
+
+double fmaProbe_scalar(idx_t iters, double *sink) {
+    double acc[PROBE_CHAINS];
+    for (int c = 0; c < PROBE_CHAINS; c++) acc[c] = 1e-3 * c;
+    for (idx_t it = 0; it < iters; it++) {
+        #pragma GCC unroll PROBE_CHAINS
+        for (int c = 0; c < PROBE_CHAINS; c++) acc[c] = acc[c] * 0.999999 + 1e-9;
+    }
+    double sum = 0.0;
+    for (int c = 0; c < PROBE_CHAINS; c++) sum += acc[c];
+    *sink = sum;
+    return 2.0 * PROBE_CHAINS * iters;
+}
+
+// c[0:n] = a[0:k] * B[0:k, 0:n], one dot product per output element
+void rowTimesCols_scalar(idx_t k, const double *a, const double *b, idx_t ldb, double *c, idx_t n) {
+    for (idx_t j = 0; j < n; j++) {
+        double sum = 0.0;
+        for (idx_t p = 0; p < k; p++) sum += a[p] * b[p * ldb + j];
+        c[j] = sum;
+    }
+}
+
+double dot_scalar(idx_t n, const double *x, const double *y) {
+    double sum = 0.0;
+    for (idx_t k = 0; k < n; k++) sum += x[k] * y[k];
+    return sum;
+}
+
+// C[0:mr, 0:nr] += Ap * Bp over kc, accumulating in an MR x NR register block.
+void microKernel_scalar(idx_t kc, const double *Ap, const double *Bp, double *C, idx_t ldc, idx_t mr, idx_t nr) {
+    double c[GEMM_MR][GEMM_NR] = {};
+    for (idx_t k = 0; k < kc; k++) {
+        for (idx_t i = 0; i < GEMM_MR; i++) {
+            double a = Ap[i];
+            for (idx_t j = 0; j < GEMM_NR; j++) {
+                c[i][j] += a * Bp[j];
+            }
+        }
+        Ap += GEMM_MR;
+        Bp += GEMM_NR;
+    }
+    for (idx_t i = 0; i < mr; i++) {
+        for (idx_t j = 0; j < nr; j++) {
+            C[i * ldc + j] += c[i][j];
+        }
+    }
+}
+
+
+#ifdef CPD_X86
+// AVX2 + FMA kernels (Haswell, Zen): 4 doubles per vector.
+
+__attribute__((target("avx2,fma")))
+void axpy_avx2(idx_t n, double a, const double *x, double *y) {
+    __m256d va = _mm256_set1_pd(a);
+    idx_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256d y0 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x + j), _mm256_loadu_pd(y + j));
+        __m256d y1 = _mm256_fmadd_pd(va, _mm256_loadu_pd(x + j + 4), _mm256_loadu_pd(y + j + 4));
+        _mm256_storeu_pd(y + j, y0);
+        _mm256_storeu_pd(y + j + 4, y1);
+    }
+    for (; j + 4 <= n; j += 4) {
+        _mm256_storeu_pd(y + j, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + j), _mm256_loadu_pd(y + j)));
+    }
+    for (; j < n; j++) y[j] += a * x[j];
+}
+
+// 8 floats per vector.
+__attribute__((target("avx2,fma")))
+void axpyf_avx2(idx_t n, float a, const float *x, float *y) {
+    __m256 va = _mm256_set1_ps(a);
+    idx_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m256 y0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j));
+        __m256 y1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j + 8), _mm256_loadu_ps(y + j + 8));
+        _mm256_storeu_ps(y + j, y0);
+        _mm256_storeu_ps(y + j + 8, y1);
+    }
+    for (; j + 8 <= n; j += 8) {
+        _mm256_storeu_ps(y + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j)));
+    }
+    for (; j < n; j++) y[j] += a * x[j];
+}
+
+// bf16 is widened by zero-extending to 32 bits and shifting into the float's top half.
+__attribute__((target("avx2,fma")))
+void axpybf16_avx2(idx_t n, float a, const bf16 *x, float *y) {
+    __m256 va = _mm256_set1_ps(a);
+    idx_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(x + j)));
+        __m256 xv = _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+        _mm256_storeu_ps(y + j, _mm256_fmadd_ps(va, xv, _mm256_loadu_ps(y + j)));
+    }
+    for (; j < n; j++) y[j] += a * widen(x[j]);
+}
+
+// Vectorises across j: each lane keeps the running sum of one output element.
+__attribute__((target("avx2,fma")))
+void rowTimesCols_avx2(idx_t k, const double *a, const double *b, idx_t ldb, double *c, idx_t n) {
+    idx_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        for (idx_t p = 0; p < k; p++) {
+            __m256d va = _mm256_broadcast_sd(a + p);
+            s0 = _mm256_fmadd_pd(va, _mm256_loadu_pd(b + p * ldb + j), s0);
+            s1 = _mm256_fmadd_pd(va, _mm256_loadu_pd(b + p * ldb + j + 4), s1);
+        }
+        _mm256_storeu_pd(c + j, s0);
+        _mm256_storeu_pd(c + j + 4, s1);
+    }
+    rowTimesCols_scalar(k, a, b + j, ldb, c + j, n - j);
+}
+
+__attribute__((target("avx2,fma")))
+double dot_avx2(idx_t n, const double *x, const double *y) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    idx_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + k), _mm256_loadu_pd(y + k), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + k + 4), _mm256_loadu_pd(y + k + 4), s1);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+    double sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; k < n; k++) sum += x[k] * y[k];
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+double fmaProbe_avx2(idx_t iters, double *sink) {
+    __m256d acc[PROBE_CHAINS];
+    for (int c = 0; c < PROBE_CHAINS; c++) acc[c] = _mm256_set1_pd(1e-3 * c);
+    __m256d m = _mm256_set1_pd(0.999999), a = _mm256_set1_pd(1e-9);
+    for (idx_t it = 0; it < iters; it++) {
+        #pragma GCC unroll PROBE_CHAINS
+        for (int c = 0; c < PROBE_CHAINS; c++) acc[c] = _mm256_fmadd_pd(acc[c], m, a);
+    }
+    for (int c = 1; c < PROBE_CHAINS; c++) acc[0] = _mm256_add_pd(acc[0], acc[c]);
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc[0]);
+    *sink = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return 2.0 * 4 * PROBE_CHAINS * iters;
+}
+
+// 6x8 micro-kernel: 12 accumulators, 2 B vectors and 1 broadcast fit in 16 ymm registers.
+__attribute__((target("avx2,fma")))
+void microKernel_avx2(idx_t kc, const double *Ap, const double *Bp, double *C, idx_t ldc, idx_t mr, idx_t nr) {
+    __m256d c[6][2];
+    for (idx_t i = 0; i < 6; i++) c[i][0] = c[i][1] = _mm256_setzero_pd();
+    for (idx_t k = 0; k < kc; k++) {
+        __m256d b0 = _mm256_loadu_pd(Bp);
+        __m256d b1 = _mm256_loadu_pd(Bp + 4);
+        for (idx_t i = 0; i < 6; i++) {
+            __m256d a = _mm256_broadcast_sd(Ap + i);
+            c[i][0] = _mm256_fmadd_pd(a, b0, c[i][0]);
+            c[i][1] = _mm256_fmadd_pd(a, b1, c[i][1]);
+        }
+        Ap += 6;
+        Bp += 8;
+    }
+    if (mr == 6 && nr == 8) {
+        for (idx_t i = 0; i < 6; i++) {
+            _mm256_storeu_pd(C + i * ldc, _mm256_add_pd(_mm256_loadu_pd(C + i * ldc), c[i][0]));
+            _mm256_storeu_pd(C + i * ldc + 4, _mm256_add_pd(_mm256_loadu_pd(C + i * ldc + 4), c[i][1]));
+        }
+        return;
+    }
+    double tile[6][8];
+    for (idx_t i = 0; i < 6; i++) {
+        _mm256_storeu_pd(tile[i], c[i][0]);
+        _mm256_storeu_pd(tile[i] + 4, c[i][1]);
+    }
+    for (idx_t i = 0; i < mr; i++)
+        for (idx_t j = 0; j < nr; j++) C[i * ldc + j] += tile[i][j];
+}
+
+
+// AVX-512F kernels (Skylake-X and later): 8 doubles per vector.
+
+__attribute__((target("avx512f")))
+void axpy_avx512(idx_t n, double a, const double *x, double *y) {
+    __m512d va = _mm512_set1_pd(a);
+    idx_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512d y0 = _mm512_fmadd_pd(va, _mm512_loadu_pd(x + j), _mm512_loadu_pd(y + j));
+        __m512d y1 = _mm512_fmadd_pd(va, _mm512_loadu_pd(x + j + 8), _mm512_loadu_pd(y + j + 8));
+        _mm512_storeu_pd(y + j, y0);
+        _mm512_storeu_pd(y + j + 8, y1);
+    }
+    if (j < n) {
+        // Masked tail instead of a scalar remainder loop.
+        for (; j < n; j += 8) {
+            __mmask8 m = (n - j >= 8) ? (__mmask8)0xFF : (__mmask8)((1u << (n - j)) - 1);
+            __m512d yv = _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(m, x + j), _mm512_maskz_loadu_pd(m, y + j));
+            _mm512_mask_storeu_pd(y + j, m, yv);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void axpyf_avx512(idx_t n, float a, const float *x, float *y) {
+    __m512 va = _mm512_set1_ps(a);
+    idx_t j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m512 y0 = _mm512_fmadd_ps(va, _mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j));
+        __m512 y1 = _mm512_fmadd_ps(va, _mm512_loadu_ps(x + j + 16), _mm512_loadu_ps(y + j + 16));
+        _mm512_storeu_ps(y + j, y0);
+        _mm512_storeu_ps(y + j + 16, y1);
+    }
+    for (; j < n; j += 16) {
+        __mmask16 m = (n - j >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - j)) - 1);
+        __m512 yv = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + j), _mm512_maskz_loadu_ps(m, y + j));
+        _mm512_mask_storeu_ps(y + j, m, yv);
+    }
+}
+
+__attribute__((target("avx512f")))
+void axpybf16_avx512(idx_t n, float a, const bf16 *x, float *y) {
+    __m512 va = _mm512_set1_ps(a);
+    idx_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        // Zero-masked forms: the unmasked ones start from an undefined register.
+        __m512i wide = _mm512_maskz_cvtepu16_epi32((__mmask16)0xFFFF, _mm256_loadu_si256((const __m256i *)(x + j)));
+        __m512 xv = _mm512_castsi512_ps(_mm512_maskz_slli_epi32((__mmask16)0xFFFF, wide, 16));
+        _mm512_storeu_ps(y + j, _mm512_fmadd_ps(va, xv, _mm512_loadu_ps(y + j)));
+    }
+    for (; j < n; j++) y[j] += a * widen(x[j]);
+}
+
+__attribute__((target("avx512f")))
+void rowTimesCols_avx512(idx_t k, const double *a, const double *b, idx_t ldb, double *c, idx_t n) {
+    idx_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+        for (idx_t p = 0; p < k; p++) {
+            __m512d va = _mm512_set1_pd(a[p]);
+            s0 = _mm512_fmadd_pd(va, _mm512_loadu_pd(b + p * ldb + j), s0);
+            s1 = _mm512_fmadd_pd(va, _mm512_loadu_pd(b + p * ldb + j + 8), s1);
+        }
+        _mm512_storeu_pd(c + j, s0);
+        _mm512_storeu_pd(c + j + 8, s1);
+    }
+    rowTimesCols_scalar(k, a, b + j, ldb, c + j, n - j);
+}
+
+__attribute__((target("avx512f")))
+double dot_avx512(idx_t n, const double *x, const double *y) {
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    idx_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        s0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + k), _mm512_loadu_pd(y + k), s0);
+        s1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + k + 8), _mm512_loadu_pd(y + k + 8), s1);
+    }
+    double lanes[8];
+    _mm512_storeu_pd(lanes, _mm512_add_pd(s0, s1));
+    double sum = 0.0;
+    for (idx_t l = 0; l < 8; l++) sum += lanes[l];
+    for (; k < n; k++) sum += x[k] * y[k];
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+double fmaProbe_avx512(idx_t iters, double *sink) {
+    __m512d acc[PROBE_CHAINS];
+    for (int c = 0; c < PROBE_CHAINS; c++) acc[c] = _mm512_set1_pd(1e-3 * c);
+    __m512d m = _mm512_set1_pd(0.999999), a = _mm512_set1_pd(1e-9);
+    for (idx_t it = 0; it < iters; it++) {
+        #pragma GCC unroll PROBE_CHAINS
+        for (int c = 0; c < PROBE_CHAINS; c++) acc[c] = _mm512_fmadd_pd(acc[c], m, a);
+    }
+    for (int c = 1; c < PROBE_CHAINS; c++) acc[0] = _mm512_add_pd(acc[0], acc[c]);
+    double lanes[8];
+    _mm512_storeu_pd(lanes, acc[0]);
+    double sum = 0.0;
+    for (int l = 0; l < 8; l++) sum += lanes[l];
+    *sink = sum;
+    return 2.0 * 8 * PROBE_CHAINS * iters;
+}
+
+// 8x16 micro-kernel: 16 accumulators out of 32 zmm registers.
+__attribute__((target("avx512f")))
+void microKernel_avx512(idx_t kc, const double *Ap, const double *Bp, double *C, idx_t ldc, idx_t mr, idx_t nr) {
+    __m512d c[8][2];
+    for (idx_t i = 0; i < 8; i++) c[i][0] = c[i][1] = _mm512_setzero_pd();
+    for (idx_t k = 0; k < kc; k++) {
+        __m512d b0 = _mm512_loadu_pd(Bp);
+        __m512d b1 = _mm512_loadu_pd(Bp + 8);
+        for (idx_t i = 0; i < 8; i++) {
+            __m512d a = _mm512_set1_pd(Ap[i]);
+            c[i][0] = _mm512_fmadd_pd(a, b0, c[i][0]);
+            c[i][1] = _mm512_fmadd_pd(a, b1, c[i][1]);
+        }
+        Ap += 8;
+        Bp += 16;
+    }
+    __mmask8 m0 = nr >= 8 ? (__mmask8)0xFF : (__mmask8)((1u << nr) - 1);
+    __mmask8 m1 = nr >= 16 ? (__mmask8)0xFF : nr > 8 ? (__mmask8)((1u << (nr - 8)) - 1) : (__mmask8)0;
+    for (idx_t i = 0; i < mr; i++) {
+        double *row = C + i * ldc;
+        _mm512_mask_storeu_pd(row, m0, _mm512_add_pd(_mm512_maskz_loadu_pd(m0, row), c[i][0]));
+        _mm512_mask_storeu_pd(row + 8, m1, _mm512_add_pd(_mm512_maskz_loadu_pd(m1, row + 8), c[i][1]));
+    }
+}
+#endif
+
+
+Kernels kernels_scalar = {"scalar", GEMM_MR, GEMM_NR, axpy_scalar, rowTimesCols_scalar, dot_scalar, microKernel_scalar,
+                          axpyf_scalar, axpybf16_scalar, fmaProbe_scalar};
+#ifdef CPD_X86
+Kernels kernels_avx2   = {"avx2", 6, 8, axpy_avx2, rowTimesCols_avx2, dot_avx2, microKernel_avx2,
+                          axpyf_avx2, axpybf16_avx2, fmaProbe_avx2};
+Kernels kernels_avx512 = {"avx512", 8, 16, axpy_avx512, rowTimesCols_avx512, dot_avx512, microKernel_avx512,
+                          axpyf_avx512, axpybf16_avx512, fmaProbe_avx512};
+#endif
+
+Kernels kern = kernels_scalar;
+bool kernelsSelected = false;
+
+bool selectKernels(const string &requested) {
+    if (requested != "auto" && requested != "scalar" && requested != "avx2" && requested != "avx512") {
+        cerr << "Unknown ISA '" << requested << "' (expected auto, scalar, avx2 or avx512)." << endl;
+        return false;
+    }
+    kern = kernels_scalar;
+    kernelsSelected = true;
+#ifdef CPD_X86
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool has_avx512 = __builtin_cpu_supports("avx512f");
+    if (requested == "scalar") return true;
+    if (has_avx512 && (requested == "auto" || requested == "avx512")) {
+        kern = kernels_avx512;
+        return true;
+    }
+    if (has_avx2 && requested != "scalar") {
+        kern = kernels_avx2;
+    }
+#endif
+    if (requested != "auto" && requested != kern.isa) {
+        cerr << "Warning: ISA '" << requested << "' not supported here, using " << kern.isa << "." << endl;
+    }
+    return true;
+}
+
+
+// A deque of tiles is the range [front, back) packed into one word, front in
+// the high half, so the owner's pop and a thief's steal are both a single CAS
+// and tiles are never copied. Only its owner refills an empty deque.
+struct alignas(CACHE_LINE_BYTES) TileDeque {
+    atomic<uint64_t> range;
+};
+
+inline uint64_t packRange(uint64_t front, uint64_t back) { return front << 32 | back; }
+
+// Takes the front tile of d into tile.
+bool popTile(TileDeque &d, idx_t &tile) {
+    uint64_t r = d.range.load(memory_order_acquire);
+    for (;;) {
+        uint64_t front = r >> 32, back = r & 0xFFFFFFFFu;
+        if (front >= back) return false;
+        if (d.range.compare_exchange_weak(r, packRange(front + 1, back), memory_order_acq_rel)) {
+            tile = front;
+            return true;
+        }
+    }
+}
+
+// Moves the back half of victim (at least one tile) into the empty deque own.
+bool stealTiles(TileDeque &victim, TileDeque &own) {
+    uint64_t r = victim.range.load(memory_order_acquire);
+    for (;;) {
+        uint64_t front = r >> 32, back = r & 0xFFFFFFFFu;
+        if (front >= back) return false;
+        uint64_t take = (back - front + 1) / 2;
+        if (victim.range.compare_exchange_weak(r, packRange(front, back - take), memory_order_acq_rel)) {
+            own.range.store(packRange(back - take, back), memory_order_release);
+            return true;
+        }
+    }
+}
+
+void runTilesStealing(idx_t count, const function<void(idx_t)> &tile, StealStats &stats) {
+    if (count >= (idx_t)1 << 32) {
+        cerr << "runTilesStealing: " << count << " tiles exceed the 32-bit deque range." << endl;
+        abort();
+    }
+    int threads = omp_get_max_threads();
+    vector<TileDeque> deques(threads);
+    for (int t = 0; t < threads; t++) deques[t].range.store(packRange(count * t / threads, count * (t + 1) / threads));
+    stats.busy.assign(threads, 0.0);
+    stats.idle.assign(threads, 0.0);
+    stats.tiles.assign(threads, 0);
+    stats.steals.assign(threads, 0);
+
+    auto start = high_resolution_clock::now();
+    #pragma omp parallel num_threads(threads)
+    {
+        int id = omp_get_thread_num();
+        idx_t t;
+        double busy = 0.0;
+        long long tiles = 0, steals = 0;
+        for (;;) {
+            while (popTile(deques[id], t)) {
+                TRACE_SPAN("tile");
+                auto begin = high_resolution_clock::now();
+                tile(t);
+                busy += duration<double>(high_resolution_clock::now() - begin).count();
+                tiles++;
+            }
+            // Victims are tried round-robin from the next thread; when all are empty the work is done.
+            bool stole = false;
+            {
+                TRACE_SPAN("steal");
+                for (int v = 1; v < threads && !stole; v++) stole = stealTiles(deques[(id + v) % threads], deques[id]);
+            }
+            if (!stole) break;
+            steals++;
+        }
+        stats.busy[id] = busy;
+        stats.tiles[id] = tiles;
+        stats.steals[id] = steals;
+        traceBarrier();
+    }
+    double wall = duration<double>(high_resolution_clock::now() - start).count();
+    for (int id = 0; id < threads; id++) stats.idle[id] = max(0.0, wall - stats.busy[id]);
+}
+
+void transposeBlocked(idx_t rows, idx_t cols, const double *src, idx_t lds, double *dst, idx_t ldd) {
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (idx_t ii = 0; ii < rows; ii += DOT_TILE) {
+        for (idx_t jj = 0; jj < cols; jj += DOT_TILE) {
+            for (idx_t i = ii; i < min(ii + DOT_TILE, rows); i++) {
+                for (idx_t j = jj; j < min(jj + DOT_TILE, cols); j++) {
+                    dst[j * ldd + i] = src[i * lds + j];
+                }
+            }
+        }
+    }
+}
+
+void OnMultDot(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phbT, idx_t ldbt, double *phc, idx_t ldc, bool parallel) {
+    #pragma omp parallel for collapse(2) schedule(static) if(parallel)
+    for (idx_t ii = 0; ii < M; ii += DOT_TILE) {
+        for (idx_t jj = 0; jj < N; jj += DOT_TILE) {
+            for (idx_t i = ii; i < min(ii + DOT_TILE, M); i++) {
+                for (idx_t j = jj; j < min(jj + DOT_TILE, N); j++) {
+                    phc[i * ldc + j] = kern.dot(K, &pha[i * lda], &phbT[j * ldbt]);
+                }
+            }
+        }
+    }
+}
+
+
+CsrMatrix denseToCsr(idx_t rows, idx_t cols, const double *A, idx_t lda) {
+    CsrMatrix csr = {rows, cols, vector<idx_t>(rows + 1, 0), {}, {}};
+    for (idx_t i = 0; i < rows; i++) {
+        for (idx_t j = 0; j < cols; j++) {
+            if (A[i * lda + j] == 0.0) continue;
+            csr.col.push_back(j);
+            csr.val.push_back(A[i * lda + j]);
+        }
+        csr.rowStart[i + 1] = csr.val.size();
+    }
+    return csr;
+}
+
+void OnMultCsr(const CsrMatrix &A, idx_t N, const double *phb, idx_t ldb, double *phc, idx_t ldc, bool parallel) {
+    idx_t nnz = A.rowStart[A.rows];
+    #pragma omp parallel if(parallel)
+    {
+        int threads = omp_get_num_threads(), t = omp_get_thread_num();
+        // First rows whose nonzeros start at or after shares t and t + 1 of nnz.
+        idx_t begin = lower_bound(A.rowStart.begin(), A.rowStart.end() - 1, nnz * t / threads) - A.rowStart.begin();
+        idx_t end = lower_bound(A.rowStart.begin(), A.rowStart.end() - 1, nnz * (t + 1) / threads) - A.rowStart.begin();
+        if (t == threads - 1) end = A.rows;
+        for (idx_t i = begin; i < end; i++) {
+            double *crow = &phc[i * ldc];
+            zeroMatrix(1, N, crow, ldc);
+            for (idx_t p = A.rowStart[i]; p < A.rowStart[i + 1]; p++) axpyRow(N, A.val[p], &phb[A.col[p] * ldb], crow);
+        }
+    }
+}
+
+void OnMultSymmetric(idx_t M, idx_t N, BlockSizes bk, const double *pha, idx_t lda, const double *phb, idx_t ldb,
+                     double *phc, idx_t ldc, bool parallel) {
+    zeroMatrix(M, N, phc, ldc);
+    #pragma omp parallel for collapse(2) schedule(static) if(parallel)
+    for (idx_t ii = 0; ii < M; ii += bk.m) {
+        for (idx_t jj = 0; jj < N; jj += bk.n) {
+            idx_t j1 = min(jj + bk.n, N);
+            for (idx_t kk = 0; kk < M; kk += bk.k) {
+                for (idx_t i = ii; i < min(ii + bk.m, M); i++) {
+                    for (idx_t k = kk; k < min(kk + bk.k, M); k++) {
+                        double a = k >= i ? pha[i * lda + k] : pha[k * lda + i];
+                        axpyRow(j1 - jj, a, &phb[k * ldb + jj], &phc[i * ldc + jj]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void OnMultTriangular(idx_t M, idx_t N, BlockSizes bk, const double *pha, idx_t lda, const double *phb, idx_t ldb,
+                      double *phc, idx_t ldc, bool parallel) {
+    zeroMatrix(M, N, phc, ldc);
+    #pragma omp parallel for collapse(2) schedule(dynamic) if(parallel)
+    for (idx_t ii = 0; ii < M; ii += bk.m) {
+        for (idx_t jj = 0; jj < N; jj += bk.n) {
+            idx_t j1 = min(jj + bk.n, N);
+            // k tiles left of the row tile's diagonal hold only zeros.
+            for (idx_t kk = ii / bk.k * bk.k; kk < M; kk += bk.k) {
+                for (idx_t i = ii; i < min(ii + bk.m, M); i++) {
+                    for (idx_t k = max(kk, i); k < min(kk + bk.k, M); k++) {
+                        axpyRow(j1 - jj, pha[i * lda + k], &phb[k * ldb + jj], &phc[i * ldc + jj]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+const vector<LoopVariant> loopVariants = {
+    LOOP_VARIANTS("", 0, 0, 0),
+    LOOP_VARIANTS("blocked-", VARIANT_TI, VARIANT_TJ, VARIANT_TK),
+};
+
+
+void packA(idx_t mc, idx_t kc, double alpha, const double *A, idx_t lda, double *Ap, idx_t MR) {
+    TRACE_SPAN("pack_a");
+    for (idx_t ir = 0; ir < mc; ir += MR) {
+        idx_t mr = min(MR, mc - ir);
+        for (idx_t k = 0; k < kc; k++) {
+            for (idx_t i = 0; i < mr; i++) Ap[i] = alpha * A[(ir + i) * lda + k];
+            for (idx_t i = mr; i < MR; i++) Ap[i] = 0.0;
+            Ap += MR;
+        }
+    }
+}
+
+void packB(idx_t kc, idx_t nc, const double *B, idx_t ldb, double *Bp, idx_t NR) {
+    TRACE_SPAN("pack_b");
+    for (idx_t jr = 0; jr < nc; jr += NR) {
+        idx_t nr = min(NR, nc - jr);
+        double *dst = Bp + jr * kc;
+        for (idx_t k = 0; k < kc; k++) {
+            for (idx_t j = 0; j < nr; j++) dst[j] = B[k * ldb + jr + j];
+            for (idx_t j = nr; j < NR; j++) dst[j] = 0.0;
+            dst += NR;
+        }
+    }
+}
+
+void OnMultPacked(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phb, idx_t ldb, double *phc, idx_t ldc, bool parallel) {
+    zeroMatrix(M, N, phc, ldc);
+
+    const idx_t MR = kern.mr, NR = kern.nr;
+    idx_t threads = parallel ? omp_get_max_threads() : 1;
+    bool splitRows = (M + GEMM_MC - 1) / GEMM_MC >= threads;
+
+    double *Bp = allocMatrix(GEMM_KC * (GEMM_NC + GEMM_NR_MAX), false);
+    double *sharedAp = splitRows ? nullptr : allocMatrix((GEMM_MC + GEMM_MR_MAX) * GEMM_KC, false);
+
+    #pragma omp parallel if(parallel)
+    {
+        // A panels are private to each thread; the B panel is packed once and shared.
+        double *Ap = splitRows ? allocMatrix((GEMM_MC + GEMM_MR_MAX) * GEMM_KC, false) : sharedAp;
+
+        for (idx_t jc = 0; jc < N; jc += GEMM_NC) {
+            idx_t nc = min<idx_t>(GEMM_NC, N - jc);
+            for (idx_t pc = 0; pc < K; pc += GEMM_KC) {
+                idx_t kc = min<idx_t>(GEMM_KC, K - pc);
+
+                #pragma omp for schedule(static) nowait
+                for (idx_t jr = 0; jr < nc; jr += NR) {
+                    packB(kc, min(NR, nc - jr), &phb[pc * ldb + jc + jr], ldb, Bp + jr * kc, NR);
+                }
+                traceBarrier();
+
+                if (splitRows) {
+                    #pragma omp for schedule(static) nowait
+                    for (idx_t ic = 0; ic < M; ic += GEMM_MC) {
+                        idx_t mc = min<idx_t>(GEMM_MC, M - ic);
+                        packA(mc, kc, 1.0, &pha[ic * lda + pc], lda, Ap, MR);
+
+                        TRACE_SPAN("compute");
+                        for (idx_t jr = 0; jr < nc; jr += NR) {
+                            for (idx_t ir = 0; ir < mc; ir += MR) {
+                                kern.microKernel(kc, Ap + ir * kc, Bp + jr * kc,
+                                                 &phc[(ic + ir) * ldc + jc + jr], ldc,
+                                                 min(MR, mc - ir), min(NR, nc - jr));
+                            }
+                        }
+                    }
+                    traceBarrier();
+                } else {
+                    for (idx_t ic = 0; ic < M; ic += GEMM_MC) {
+                        idx_t mc = min<idx_t>(GEMM_MC, M - ic);
+                        #pragma omp single nowait
+                        packA(mc, kc, 1.0, &pha[ic * lda + pc], lda, Ap, MR);
+                        traceBarrier();
+
+                        {
+                            TRACE_SPAN("compute");
+                            #pragma omp for schedule(static) nowait
+                            for (idx_t jr = 0; jr < nc; jr += NR) {
+                                for (idx_t ir = 0; ir < mc; ir += MR) {
+                                    kern.microKernel(kc, Ap + ir * kc, Bp + jr * kc,
+                                                     &phc[(ic + ir) * ldc + jc + jr], ldc,
+                                                     min(MR, mc - ir), min(NR, nc - jr));
+                                }
+                            }
+                        }
+                        traceBarrier();
+                    }
+                }
+            }
+        }
+
+        if (splitRows) freeMatrix(Ap);
+    }
+
+    freeMatrix(sharedAp);
+    freeMatrix(Bp);
+}
+
+
+// An R x W block of C is accumulated in acc over the whole k loop; with every
+// trip count a template parameter the compiler keeps acc in vector registers,
+// like the micro-kernels, without packing or edge cases. C is read only when
+// beta is non-zero. Each ISA picks the block that fills its register file.
+template <idx_t N, idx_t R, idx_t W>
+inline __attribute__((always_inline))
+void smallBody(const double *A, idx_t lda, const double *B, idx_t ldb, double *C, idx_t ldc, double alpha, double beta) {
+    static_assert(N % R == 0 && N % W == 0, "the register block must divide the size");
+    for (idx_t i = 0; i < N; i += R) {
+        for (idx_t j0 = 0; j0 < N; j0 += W) {
+            double acc[R][W] = {};
+            for (idx_t k = 0; k < N; k++) {
+                const double *b = &B[k * ldb + j0];
+                #pragma GCC unroll 8
+                for (idx_t r = 0; r < R; r++) {
+                    double a = A[(i + r) * lda + k];
+                    #pragma omp simd
+                    for (idx_t j = 0; j < W; j++) acc[r][j] += a * b[j];
+                }
+            }
+            #pragma GCC unroll 8
+            for (idx_t r = 0; r < R; r++) {
+                double *c = &C[(i + r) * ldc + j0];
+                if (beta == 0.0) {
+                    #pragma omp simd
+                    for (idx_t j = 0; j < W; j++) c[j] = alpha * acc[r][j];
+                } else {
+                    #pragma omp simd
+                    for (idx_t j = 0; j < W; j++) c[j] = alpha * acc[r][j] + beta * c[j];
+                }
+            }
+        }
+    }
+}
+
+// 4x4 doubles: 8 of the 16 xmm registers.
+template <idx_t N>
+void small_scalar(const double *A, idx_t lda, const double *B, idx_t ldb, double *C, idx_t ldc, double alpha, double beta) {
+    smallBody<N, 4, 4>(A, lda, B, ldb, C, ldc, alpha, beta);
+}
+
+#ifdef CPD_X86
+// 6x8 (or 4x8) doubles: up to 12 of the 16 ymm registers.
+template <idx_t N>
+__attribute__((target("avx2,fma")))
+void small_avx2(const double *A, idx_t lda, const double *B, idx_t ldb, double *C, idx_t ldc, double alpha, double beta) {
+    smallBody<N, N % 6 == 0 ? 6 : 4, 8>(A, lda, B, ldb, C, ldc, alpha, beta);
+}
+
+// 8x16 (or 8x8) doubles: up to 16 of the 32 zmm registers.
+template <idx_t N>
+__attribute__((target("avx512f")))
+void small_avx512(const double *A, idx_t lda, const double *B, idx_t ldb, double *C, idx_t ldc, double alpha, double beta) {
+    smallBody<N, 8, N % 16 == 0 ? 16 : 8>(A, lda, B, ldb, C, ldc, alpha, beta);
+}
+#define SMALL_KERNEL(n) {n, small_scalar<n>, small_avx2<n>, small_avx512<n>}
+#else
+#define SMALL_KERNEL(n) {n, small_scalar<n>, small_scalar<n>, small_scalar<n>}
+#endif
+
+struct SmallKernels {
+    idx_t n;
+    SmallKernel scalar, avx2, avx512;
+};
+
+const SmallKernels smallKernels[] = {SMALL_KERNEL(16), SMALL_KERNEL(24), SMALL_KERNEL(32), SMALL_KERNEL(48),
+                                     SMALL_KERNEL(64), SMALL_KERNEL(96), SMALL_KERNEL(128)};
+
+SmallKernel smallKernelFor(idx_t M, idx_t N, idx_t K) {
+    if (M != N || N != K) return nullptr;
+    for (const SmallKernels &s : smallKernels) {
+        if (s.n != N) continue;
+        if (!strcmp(kern.isa, "avx512")) return s.avx512;
+        if (!strcmp(kern.isa, "avx2")) return s.avx2;
+        return s.scalar;
+    }
+    return nullptr;
+}
+
+void smallGemm(idx_t M, idx_t N, idx_t K, double alpha, const double *A, idx_t lda, const double *B, idx_t ldb,
+               double beta, double *C, idx_t ldc) {
+    for (idx_t i = 0; i < M; i++) {
+        double *c = &C[i * ldc];
+        if (beta == 0.0) memset(c, 0, N * sizeof(double));
+        else if (beta != 1.0) for (idx_t j = 0; j < N; j++) c[j] *= beta;
+        for (idx_t k = 0; k < K; k++) kern.axpy(N, alpha * A[i * lda + k], &B[k * ldb], c);
+    }
+}
+
+size_t strassenWorkspace(idx_t M, idx_t N, idx_t K, const StrassenConfig &cfg, int depth) {
+    if (M <= cfg.cutoff || N <= cfg.cutoff || K <= cfg.cutoff) return 0;
+    idx_t m = M / 2, n = N / 2, k = K / 2;
+    size_t own = 4 * (size_t)(m * k) + 4 * (size_t)(k * n) + 7 * (size_t)(m * n);
+    size_t child = strassenWorkspace(m, n, k, cfg, depth + 1);
+    return own + (depth < cfg.taskDepth ? 7 : 1) * child;
+}
+
+// Z = X + sign * Y for m x n operands.
+void matAdd(idx_t m, idx_t n, const double *X, idx_t ldx, const double *Y, idx_t ldy, double *Z, idx_t ldz, double sign) {
+    for (idx_t i = 0; i < m; i++) {
+        for (idx_t j = 0; j < n; j++) {
+            Z[i * ldz + j] = X[i * ldx + j] + sign * Y[i * ldy + j];
+        }
+    }
+}
+
+void strassenRec(idx_t M, idx_t N, idx_t K, const double *A, idx_t lda, const double *B, idx_t ldb,
+                 double *C, idx_t ldc, const StrassenConfig &cfg, int depth, double *ws) {
+    if (M <= cfg.cutoff || N <= cfg.cutoff || K <= cfg.cutoff) {
+        OnMultBlock(M, N, K, cfg.bk, (double *)A, lda, (double *)B, ldb, C, ldc);
+        return;
+    }
+
+    idx_t m = M / 2, n = N / 2, k = K / 2;
+    const double *A11 = A, *A12 = A + k, *A21 = A + m * lda, *A22 = A21 + k;
+    const double *B11 = B, *B12 = B + n, *B21 = B + k * ldb, *B22 = B21 + n;
+    double *C11 = C, *C12 = C + n, *C21 = C + m * ldc, *C22 = C21 + n;
+
+    double *S[4], *T[4], *P[7];
+    double *next = ws;
+    for (int i = 0; i < 4; i++, next += m * k) S[i] = next;
+    for (int i = 0; i < 4; i++, next += k * n) T[i] = next;
+    for (int i = 0; i < 7; i++, next += m * n) P[i] = next;
+
+    matAdd(m, k, A21, lda, A22, lda, S[0], k, 1.0);    // S1 = A21 + A22
+    matAdd(m, k, S[0], k, A11, lda, S[1], k, -1.0);    // S2 = S1 - A11
+    matAdd(m, k, A11, lda, A21, lda, S[2], k, -1.0);   // S3 = A11 - A21
+    matAdd(m, k, A12, lda, S[1], k, S[3], k, -1.0);    // S4 = A12 - S2
+    matAdd(k, n, B12, ldb, B11, ldb, T[0], n, -1.0);   // T1 = B12 - B11
+    matAdd(k, n, B22, ldb, T[0], n, T[1], n, -1.0);    // T2 = B22 - T1
+    matAdd(k, n, B22, ldb, B12, ldb, T[2], n, -1.0);   // T3 = B22 - B12
+    matAdd(k, n, T[1], n, B21, ldb, T[3], n, -1.0);    // T4 = T2 - B21
+
+    const double *lhs[7] = {A11, A12, S[3], A22, S[0], S[1], S[2]};
+    idx_t ldl[7] = {lda, lda, k, lda, k, k, k};
+    const double *rhs[7] = {B11, B21, B22, T[3], T[0], T[1], T[2]};
+    idx_t ldr[7] = {ldb, ldb, ldb, n, n, n, n};
+
+    bool spawn = depth < cfg.taskDepth;
+    size_t childSize = strassenWorkspace(m, n, k, cfg, depth + 1);
+    for (int p = 0; p < 7; p++) {
+        double *childWs = next + (spawn ? p * childSize : 0);
+        #pragma omp task if(spawn) firstprivate(p, childWs)
+        strassenRec(m, n, k, lhs[p], ldl[p], rhs[p], ldr[p], P[p], n, cfg, depth + 1, childWs);
+    }
+    #pragma omp taskwait
+
+    // U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5
+    // C11 = P1 + P2, C12 = U4 + P3, C21 = U3 - P4, C22 = U3 + P5
+    for (idx_t i = 0; i < m; i++) {
+        for (idx_t j = 0; j < n; j++) {
+            idx_t x = i * n + j;
+            double u2 = P[0][x] + P[5][x];
+            double u3 = u2 + P[6][x];
+            C11[i * ldc + j] = P[0][x] + P[1][x];
+            C12[i * ldc + j] = u2 + P[4][x] + P[2][x];
+            C21[i * ldc + j] = u3 - P[3][x];
+            C22[i * ldc + j] = u3 + P[4][x];
+        }
+    }
+
+    // Peel odd edges: the last column of A / row of B, then the last column and row of C.
+    if (K > 2 * k) {
+        BlockSizes rank1 = {cfg.bk.m, cfg.bk.n, 1, cfg.bk.order};
+        blockAccumulate(2 * m, 2 * n, 1, rank1, A + 2 * k, lda, B + 2 * k * ldb, ldb, C, ldc, false);
+    }
+    if (N > 2 * n) {
+        OnMultBlock(2 * m, N - 2 * n, K, cfg.bk, (double *)A, lda, (double *)(B + 2 * n), ldb, C + 2 * n, ldc);
+    }
+    if (M > 2 * m) {
+        OnMultBlock(M - 2 * m, N, K, cfg.bk, (double *)(A + 2 * m * lda), lda, (double *)B, ldb, C + 2 * m * ldc, ldc);
+    }
+}
+
+void OnMultStrassen(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phb, idx_t ldb, double *phc, idx_t ldc,
+                    const StrassenConfig &cfg, double *arena, bool parallel) {
+    #pragma omp parallel if(parallel)
+    #pragma omp single
+    strassenRec(M, N, K, pha, lda, phb, ldb, phc, ldc, cfg, 0, arena);
+}
+
+
+// Interleaves the bits of the tile coordinates: row bits odd, column bits even.
+uint64_t mortonCode(uint64_t tr, uint64_t tc) {
+    uint64_t code = 0;
+    for (int b = 0; b < 32; b++) {
+        code |= ((tc >> b) & 1) << (2 * b);
+        code |= ((tr >> b) & 1) << (2 * b + 1);
+    }
+    return code;
+}
+
+TiledView rowMajorView(double *data, idx_t rows, idx_t cols, idx_t ld) {
+    return TiledView{data, rows, cols, ld, (rows + REC_TILE - 1) / REC_TILE, (cols + REC_TILE - 1) / REC_TILE, false, {}};
+}
+
+bool allocMortonView(idx_t rows, idx_t cols, TiledView &v) {
+    v = rowMajorView(nullptr, rows, cols, REC_TILE);
+    v.morton = true;
+    vector<pair<uint64_t, idx_t>> order;
+    for (idx_t tr = 0; tr < v.tilesR; tr++)
+        for (idx_t tc = 0; tc < v.tilesC; tc++) order.push_back({mortonCode(tr, tc), tr * v.tilesC + tc});
+    sort(order.begin(), order.end());
+    v.offset.assign(order.size(), 0);
+    for (size_t i = 0; i < order.size(); i++) v.offset[order[i].second] = i * REC_TILE_STRIDE;
+    v.data = allocMatrix(order.size() * REC_TILE_STRIDE, false);
+    if (!v.data) return false;
+    memset(v.data, 0, order.size() * REC_TILE_STRIDE * sizeof(double));
+    return true;
+}
+
+void toMorton(const double *src, idx_t lds, TiledView &dst) {
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (idx_t tr = 0; tr < dst.tilesR; tr++) {
+        for (idx_t tc = 0; tc < dst.tilesC; tc++) {
+            idx_t ldt;
+            double *t = dst.tile(tr, tc, ldt);
+            idx_t r0 = tr * REC_TILE, c0 = tc * REC_TILE;
+            for (idx_t i = 0; i < min<idx_t>(REC_TILE, dst.rows - r0); i++)
+                memcpy(&t[i * ldt], &src[(r0 + i) * lds + c0], min<idx_t>(REC_TILE, dst.cols - c0) * sizeof(double));
+        }
+    }
+}
+
+void fromMorton(const TiledView &src, double *dst, idx_t ldd) {
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (idx_t tr = 0; tr < src.tilesR; tr++) {
+        for (idx_t tc = 0; tc < src.tilesC; tc++) {
+            idx_t ldt;
+            const double *t = src.tile(tr, tc, ldt);
+            idx_t r0 = tr * REC_TILE, c0 = tc * REC_TILE;
+            for (idx_t i = 0; i < min<idx_t>(REC_TILE, src.rows - r0); i++)
+                memcpy(&dst[(r0 + i) * ldd + c0], &t[i * ldt], min<idx_t>(REC_TILE, src.cols - c0) * sizeof(double));
+        }
+    }
+}
+
+// C[tiles i0:i1, j0:j1] += A[i0:i1, k0:k1] * B[k0:k1, j0:j1], in tile units.
+// The views go by pointer: a task firstprivatizes reference arguments, which
+// would copy the Morton offset table at every node, deferred or not.
+void recursiveAccumulate(idx_t i0, idx_t i1, idx_t j0, idx_t j1, idx_t k0, idx_t k1,
+                         const TiledView *A, const TiledView *B, const TiledView *C, bool spawn) {
+    idx_t m = i1 - i0, n = j1 - j0, k = k1 - k0;
+    if (m == 1 && n == 1 && k == 1) {
+        idx_t lda, ldb, ldc;
+        const double *a = A->tile(i0, k0, lda);
+        const double *b = B->tile(k0, j0, ldb);
+        double *c = C->tile(i0, j0, ldc);
+        tileAccumulate(0, A->tileRows(i0), 0, B->tileCols(j0), 0, A->tileCols(k0), a, lda, b, ldb, c, ldc);
+        return;
+    }
+    spawn = spawn && m * n * k >= REC_TASK_MIN;
+    if (m >= n && m >= k) {
+        idx_t mid = i0 + m / 2;
+        #pragma omp task if(spawn)
+        recursiveAccumulate(i0, mid, j0, j1, k0, k1, A, B, C, spawn);
+        recursiveAccumulate(mid, i1, j0, j1, k0, k1, A, B, C, spawn);
+        #pragma omp taskwait
+    } else if (n >= k) {
+        idx_t mid = j0 + n / 2;
+        #pragma omp task if(spawn)
+        recursiveAccumulate(i0, i1, j0, mid, k0, k1, A, B, C, spawn);
+        recursiveAccumulate(i0, i1, mid, j1, k0, k1, A, B, C, spawn);
+        #pragma omp taskwait
+    } else {
+        idx_t mid = k0 + k / 2;
+        recursiveAccumulate(i0, i1, j0, j1, k0, mid, A, B, C, spawn);
+        recursiveAccumulate(i0, i1, j0, j1, mid, k1, A, B, C, spawn);
+    }
+}
+
+void OnMultRecursive(const TiledView &A, const TiledView &B, const TiledView &C, bool parallel) {
+    if (C.morton) memset(C.data, 0, C.tilesR * C.tilesC * REC_TILE_STRIDE * sizeof(double));
+    else zeroMatrix(C.rows, C.cols, C.data, C.ld);
+    #pragma omp parallel if(parallel)
+    #pragma omp single
+    recursiveAccumulate(0, C.tilesR, 0, C.tilesC, 0, A.tilesC, &A, &B, &C, parallel);
+}
+
+
+// A tightly packed (ld = cols) row-major header with the data one page in.
+MatrixFileHeader matrixHeader(idx_t rows, idx_t cols, uint32_t dtype, uint64_t seed) {
+    MatrixFileHeader h = {};
+    memcpy(h.magic, MATRIX_FILE_MAGIC, sizeof(h.magic));
+    h.dtype = dtype;
+    h.layout = LAYOUT_ROW_MAJOR;
+    h.rows = rows;
+    h.cols = cols;
+    h.ld = cols;
+    h.alignment = sysconf(_SC_PAGESIZE);
+    h.dataOffset = h.alignment;
+    h.seed = seed;
+    return h;
+}
+
+bool mapMatrixFile(const string &path, idx_t rows, idx_t cols, uint64_t seed, bool writable, MappedMatrix &m, bool &created) {
+    MatrixFileHeader want = matrixHeader(rows, cols, DTYPE_F64, seed), have = {};
+    m.bytes = want.dataOffset + (size_t)rows * cols * sizeof(double);
+    m.fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m.fd < 0) {
+        cerr << "Cannot open " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    struct stat st;
+    fstat(m.fd, &st);
+    // The alignment may differ between hosts; everything else must match.
+    bool same = (size_t)st.st_size == m.bytes && pread(m.fd, &have, sizeof(have), 0) == (ssize_t)sizeof(have);
+    have.alignment = want.alignment;
+    created = !same || memcmp(&have, &want, sizeof(want)) != 0;
+    if (created && (ftruncate(m.fd, 0) != 0 || ftruncate(m.fd, m.bytes) != 0 ||
+                    pwrite(m.fd, &want, sizeof(want), 0) != (ssize_t)sizeof(want))) {
+        cerr << "Cannot rewrite " << path << ": " << strerror(errno) << endl;
+        close(m.fd);
+        return false;
+    }
+    int prot = (writable || created) ? PROT_READ | PROT_WRITE : PROT_READ;
+    m.base = mmap(nullptr, m.bytes, prot, MAP_SHARED, m.fd, 0);
+    if (m.base == MAP_FAILED) {
+        cerr << "Cannot map " << path << ": " << strerror(errno) << endl;
+        close(m.fd);
+        return false;
+    }
+    madvise(m.base, m.bytes, MADV_SEQUENTIAL);
+    m.data = (double *)((char *)m.base + want.dataOffset);
+    return true;
+}
+
+void unmapMatrixFile(MappedMatrix &m) {
+    munmap(m.base, m.bytes);
+    close(m.fd);
+}
+
+bool loadMatrixFile(const string &path, MatrixFile &f) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Cannot open " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    struct stat st;
+    MatrixFileHeader &h = f.header;
+    bool ok = fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);
+    if (!ok || memcmp(h.magic, MATRIX_FILE_MAGIC, sizeof(h.magic)) != 0) {
+        cerr << path << " is not a matrix file." << endl;
+        close(fd);
+        return false;
+    }
+    const char *problem = nullptr;
+    if (h.dtype != DTYPE_F64) problem = "only f64 matrices are loaded";
+    else if (h.layout != LAYOUT_ROW_MAJOR) problem = "unknown layout";
+    // rows * ld bytes must fit idx_t, so neither the size below nor the kernels' i * lda can wrap.
+    else if (h.rows == 0 || h.cols == 0 || h.ld < h.cols || h.ld > (uint64_t)INT64_MAX / sizeof(double) / h.rows) problem = "bad dimensions";
+    else if (h.dataOffset < sizeof(h) || h.dataOffset % CACHE_LINE_BYTES != 0) problem = "data is not cache-line aligned";
+    else if ((uint64_t)st.st_size < h.dataOffset ||
+             (uint64_t)st.st_size - h.dataOffset < ((h.rows - 1) * h.ld + h.cols) * sizeof(double)) problem = "file is truncated";
+    if (problem) {
+        cerr << path << ": " << problem << "." << endl;
+        close(fd);
+        return false;
+    }
+    f.bytes = st.st_size;
+    f.base = mmap(nullptr, f.bytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (f.base == MAP_FAILED) {
+        cerr << "Cannot map " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    f.data = (double *)((char *)f.base + h.dataOffset);
+    return true;
+}
+
+void closeMatrixFile(MatrixFile &f) {
+    munmap(f.base, f.bytes);
+}
+
+bool saveMatrixData(const string &path, idx_t rows, idx_t cols, const void *matrix, idx_t ld, size_t elementBytes, uint32_t dtype) {
+    MatrixFileHeader h = matrixHeader(rows, cols, dtype, MATRIX_SEED_NONE);
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write((const char *)&h, sizeof(h));
+    vector<char> padding(h.dataOffset - sizeof(h), 0);
+    out.write(padding.data(), padding.size());
+    for (idx_t i = 0; i < rows && out; i++) out.write((const char *)matrix + i * ld * elementBytes, cols * elementBytes);
+    if (!out) cerr << "Cannot write " << path << "." << endl;
+    return (bool)out;
+}
+
+bool saveMatrixFile(const string &path, idx_t rows, idx_t cols, const double *matrix, idx_t ld) {
+    return saveMatrixData(path, rows, cols, matrix, ld, sizeof(double), DTYPE_F64);
+}
+
+bool saveMatrixFile(const string &path, idx_t rows, idx_t cols, const float *matrix, idx_t ld) {
+    return saveMatrixData(path, rows, cols, matrix, ld, sizeof(float), DTYPE_F32);
+}
+
+// Copies rows of a mapping into a staging buffer; touching the pages is what
+// reads them from disk, so this runs on the helper thread.
+void stagePanel(const double *src, double *dst, size_t count) {
+    madvise((void *)((uintptr_t)src & ~(uintptr_t)4095), count * sizeof(double), MADV_WILLNEED);
+    memcpy(dst, src, count * sizeof(double));
+}
+
+StreamTimes OnMultStream(idx_t M, idx_t N, idx_t K, BlockSizes bk, idx_t panelM, idx_t panelK,
+                         const double *pha, const double *phb, double *phc, bool parallel) {
+    StreamTimes t = {0.0, 0.0};
+    idx_t panelsM = (M + panelM - 1) / panelM;
+    idx_t panelsK = (K + panelK - 1) / panelK;
+
+    double *Abuf[2], *Bbuf[2];
+    for (int s = 0; s < 2; s++) {
+        Abuf[s] = allocMatrix((size_t)min(panelM, M) * K, false);
+        Bbuf[s] = allocMatrix((size_t)min(panelK, K) * N, false);
+    }
+
+    auto loadA = [&](idx_t p, int slot) {
+        idx_t rows = min(panelM, M - p * panelM);
+        return async(launch::async, stagePanel, pha + p * panelM * K, Abuf[slot], (size_t)(rows * K));
+    };
+    auto loadB = [&](idx_t q, int slot) {
+        idx_t rows = min(panelK, K - q * panelK);
+        return async(launch::async, stagePanel, phb + q * panelK * N, Bbuf[slot], (size_t)(rows * N));
+    };
+    auto wait = [&](future<void> &f) {
+        auto start = high_resolution_clock::now();
+        f.get();
+        t.wait += duration<double>(high_resolution_clock::now() - start).count();
+    };
+
+    int aslot = 0, bslot = 0;
+    future<void> nextA = loadA(0, 0);
+    future<void> nextB = loadB(0, 0);
+    for (idx_t p = 0; p < panelsM; p++) {
+        idx_t ii = p * panelM;
+        idx_t rows = min(panelM, M - ii);
+        wait(nextA);
+        if (p + 1 < panelsM) nextA = loadA(p + 1, aslot ^ 1);
+
+        double *Cpanel = phc + ii * N;
+        zeroMatrix(rows, N, Cpanel, N);
+        for (idx_t q = 0; q < panelsK; q++) {
+            idx_t kk = q * panelK;
+            wait(nextB);
+            // The B panel after the last one is the first of the next C panel.
+            if (q + 1 < panelsK) nextB = loadB(q + 1, bslot ^ 1);
+            else if (p + 1 < panelsM) nextB = loadB(0, bslot ^ 1);
+
+            auto start = high_resolution_clock::now();
+            blockAccumulate(rows, N, min(panelK, K - kk), bk, Abuf[aslot] + kk, K, Bbuf[bslot], N, Cpanel, N, parallel);
+            t.compute += duration<double>(high_resolution_clock::now() - start).count();
+            bslot ^= 1;
+        }
+        // Start writing the finished panel back while the next one is computed.
+        msync((void *)((uintptr_t)Cpanel & ~(uintptr_t)4095), rows * N * sizeof(double), MS_ASYNC);
+        aslot ^= 1;
+    }
+
+    for (int s = 0; s < 2; s++) {
+        freeMatrix(Abuf[s]);
+        freeMatrix(Bbuf[s]);
+    }
+    return t;
+}
+
+
+void traceBarrier() {
+    TRACE_SPAN("barrier");
+    #pragma omp barrier
+}
+
+#ifdef CPD_TRACE
+atomic<bool> traceOn{false};
+
+// One buffer per thread that has recorded a span, numbered in order of its
+// first span; buffers outlive their threads so helper threads can be traced.
+struct TraceThread {
+    int id;
+    vector<TraceEvent> events;
+};
+
+mutex traceLock;
+vector<unique_ptr<TraceThread>> traceThreads;
+thread_local TraceThread *traceSelf = nullptr;
+uint64_t traceTick0, traceTick1;
+steady_clock::time_point traceTime0, traceTime1;
+
+void traceRecord(const char *name, uint64_t start, uint64_t end) {
+    if (!traceSelf) {
+        lock_guard<mutex> guard(traceLock);
+        traceThreads.emplace_back(new TraceThread{(int)traceThreads.size(), {}});
+        traceSelf = traceThreads.back().get();
+        traceSelf->events.reserve(1 << 16);
+    }
+    traceSelf->events.push_back({name, start, end});
+}
+
+void traceStart() {
+    {
+        lock_guard<mutex> guard(traceLock);
+        for (auto &t : traceThreads) t->events.clear();
+    }
+    traceTime0 = steady_clock::now();
+    traceTick0 = traceClock();
+    traceOn.store(true, memory_order_relaxed);
+}
+
+// A window of at least 20 ms keeps the TSC rate within a few parts per million.
+void traceStop() {
+    traceOn.store(false, memory_order_relaxed);
+    this_thread::sleep_until(traceTime0 + milliseconds(20));
+    traceTime1 = steady_clock::now();
+    traceTick1 = traceClock();
+}
+
+// Ticks per microsecond over the recorded window.
+double traceTicksPerUs() {
+    double us = duration<double, micro>(traceTime1 - traceTime0).count();
+    return us > 0 ? (double)(traceTick1 - traceTick0) / us : 1.0;
+}
+
+vector<pair<string, double>> tracePhaseTotals(size_t &events) {
+    lock_guard<mutex> guard(traceLock);
+    double secondsPerTick = 1e-6 / traceTicksPerUs();
+    map<string, double> totals;
+    events = 0;
+    for (auto &t : traceThreads) {
+        for (const TraceEvent &e : t->events) totals[e.name] += (e.end - e.start) * secondsPerTick;
+        events += t->events.size();
+    }
+    return vector<pair<string, double>>(totals.begin(), totals.end());
+}
+
+bool traceWriteChrome(const string &path) {
+    lock_guard<mutex> guard(traceLock);
+    ofstream out(path, ios::trunc);
+    if (!out) {
+        cerr << "Cannot write " << path << "." << endl;
+        return false;
+    }
+    double ticksPerUs = traceTicksPerUs();
+    out << fixed << setprecision(3) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"multiplication\"}}";
+    for (auto &t : traceThreads) {
+        if (t->events.empty()) continue;
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t->id
+            << ",\"args\":{\"name\":\"thread " << t->id << "\"}}";
+        for (const TraceEvent &e : t->events) {
+            // Spans that began before traceStart clamp to it.
+            double ts = e.start > traceTick0 ? (e.start - traceTick0) / ticksPerUs : 0.0;
+            double end = e.end > traceTick0 ? (e.end - traceTick0) / ticksPerUs : 0.0;
+            out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t->id
+                << ",\"ts\":" << ts << ",\"dur\":" << end - ts << "}";
+        }
+    }
+    out << "\n]}\n";
+    if (!out) cerr << "Cannot write " << path << "." << endl;
+    return (bool)out;
+}
+#endif
+
+
+bool deviceAvailable() {
+    static const bool available = omp_get_num_devices() > 0;
+    return available;
+}
+
+DeviceTimes OnMultDevice(idx_t M, idx_t N, idx_t K, double alpha, const double *A, idx_t lda,
+                         const double *B, idx_t ldb, double beta, double *C, idx_t ldc) {
+    DeviceTimes t = {0.0, 0.0, 0.0};
+    size_t aLen = (M - 1) * lda + K, bLen = (K - 1) * ldb + N, cLen = (M - 1) * ldc + N;
+
+    auto start = high_resolution_clock::now();
+    if (beta == 0.0) {
+        #pragma omp target enter data map(to: A[0:aLen], B[0:bLen]) map(alloc: C[0:cLen])
+    } else {
+        #pragma omp target enter data map(to: A[0:aLen], B[0:bLen], C[0:cLen])
+    }
+    t.h2d = duration<double>(high_resolution_clock::now() - start).count();
+
+    // The operands are present already, so the maps below only translate addresses.
+    start = high_resolution_clock::now();
+    idx_t tilesM = (M + DEV_TILE - 1) / DEV_TILE, tilesN = (N + DEV_TILE - 1) / DEV_TILE;
+    #pragma omp target teams distribute collapse(2) thread_limit(DEV_TILE * DEV_TILE) \
+        map(to: A[0:aLen], B[0:bLen]) map(tofrom: C[0:cLen])
+    for (idx_t bi = 0; bi < tilesM; bi++) {
+        for (idx_t bj = 0; bj < tilesN; bj++) {
+            double As[DEV_TILE][DEV_TILE], Bs[DEV_TILE][DEV_TILE], Cs[DEV_TILE][DEV_TILE];
+            #pragma omp parallel for collapse(2)
+            for (int i = 0; i < DEV_TILE; i++) {
+                for (int j = 0; j < DEV_TILE; j++) Cs[i][j] = 0.0;
+            }
+            for (idx_t kk = 0; kk < K; kk += DEV_TILE) {
+                // Edge tiles are padded with zeros, so the product loop has no bounds.
+                #pragma omp parallel for collapse(2)
+                for (int i = 0; i < DEV_TILE; i++) {
+                    for (int j = 0; j < DEV_TILE; j++) {
+                        idx_t ai = bi * DEV_TILE + i, ak = kk + j, bk = kk + i, bj2 = bj * DEV_TILE + j;
+                        As[i][j] = ai < M && ak < K ? A[ai * lda + ak] : 0.0;
+                        Bs[i][j] = bk < K && bj2 < N ? B[bk * ldb + bj2] : 0.0;
+                    }
+                }
+                #pragma omp parallel for collapse(2)
+                for (int i = 0; i < DEV_TILE; i++) {
+                    for (int j = 0; j < DEV_TILE; j++) {
+                        double sum = 0.0;
+                        for (int k = 0; k < DEV_TILE; k++) sum += As[i][k] * Bs[k][j];
+                        Cs[i][j] += sum;
+                    }
+                }
+            }
+            #pragma omp parallel for collapse(2)
+            for (int i = 0; i < DEV_TILE; i++) {
+                for (int j = 0; j < DEV_TILE; j++) {
+                    idx_t ci = bi * DEV_TILE + i, cj = bj * DEV_TILE + j;
+                    if (ci >= M || cj >= N) continue;
+                    double &c = C[ci * ldc + cj];
+                    c = alpha * Cs[i][j] + (beta == 0.0 ? 0.0 : beta * c);
+                }
+            }
+        }
+    }
+    t.kernel = duration<double>(high_resolution_clock::now() - start).count();
+
+    start = high_resolution_clock::now();
+    #pragma omp target exit data map(from: C[0:cLen]) map(release: A[0:aLen], B[0:bLen])
+    t.d2h = duration<double>(high_resolution_clock::now() - start).count();
+    return t;
+}
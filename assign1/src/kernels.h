@@ -0,0 +1,771 @@
+#ifndef CPD_KERNELS_H
+#define CPD_KERNELS_H
+
+// Kernels of the matrix multiplication library: element types, matrix storage,
+// the per-ISA kernel table and every OnMult* algorithm. Templates and inline
+// helpers live here; the rest is in kernels.cpp. The public entry point is
+// gemm() in cpdgemm.h.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sys/mman.h>
+#include <omp.h>
+#include "cpdgemm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPD_X86
+#endif
+
+using namespace std;
+
+// Element types. bf16 keeps the top 16 bits of an IEEE float (8-bit exponent,
+// 7-bit mantissa); it is only a storage format and is widened to float for
+// arithmetic, so products of bf16 inputs accumulate in float.
+struct bf16 {
+    uint16_t bits;
+};
+
+inline double widen(double x) { return x; }
+inline float widen(float x) { return x; }
+inline float widen(bf16 x) {
+    uint32_t u = (uint32_t)x.bits << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+template <typename T> T narrow(double x);
+template <> inline double narrow<double>(double x) { return x; }
+template <> inline float narrow<float>(double x) { return (float)x; }
+// Round to nearest even on the 16 dropped bits.
+template <> inline bf16 narrow<bf16>(double x) {
+    float f = (float)x;
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7FFF + ((u >> 16) & 1);
+    return bf16{(uint16_t)(u >> 16)};
+}
+
+// Type of C for inputs of type T: the inputs' own type, float for bf16.
+template <typename T> struct Accumulator { typedef T type; };
+template <> struct Accumulator<bf16> { typedef float type; };
+
+// Matrix storage is cache-line aligned, or huge-page aligned when requested.
+#define CACHE_LINE_BYTES 64
+#define HUGE_PAGE_BYTES (2 * 1024 * 1024)
+
+// Allocates count elements of T; with hugePages the block is 2 MB aligned and
+// advised as transparent-huge-page backed (Linux only). Release with freeMatrix.
+template <typename T = double>
+T *allocMatrix(size_t count, bool hugePages) {
+    size_t alignment = hugePages ? HUGE_PAGE_BYTES : CACHE_LINE_BYTES;
+    size_t bytes = (count * sizeof(T) + alignment - 1) / alignment * alignment;
+    void *p = nullptr;
+    if (posix_memalign(&p, alignment, bytes) != 0) return nullptr;
+#ifdef MADV_HUGEPAGE
+    if (hugePages) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    return (T *)p;
+}
+
+void freeMatrix(void *p);
+
+// Page-locked ("pinned") storage for count doubles, which an offload runtime
+// can copy to the device by DMA without staging it: from an OpenMP allocator
+// with the pinned trait where the runtime has one, else allocMatrix storage
+// locked with mlock. Returns nullptr when neither works; release with freePinned.
+double *allocPinned(size_t count);
+void freePinned(void *p);
+
+// Zeroes a rows x ld matrix with the same static schedule over chunks of
+// rowsPerChunk rows that the parallel kernels use, so each page is first
+// touched (and placed on the NUMA node of) the thread that will work on it.
+template <typename T>
+void firstTouch(T *matrix, idx_t rows, idx_t ld, idx_t rowsPerChunk) {
+    idx_t chunks = (rows + rowsPerChunk - 1) / rowsPerChunk;
+    #pragma omp parallel for schedule(static)
+    for (idx_t c = 0; c < chunks; c++) {
+        idx_t begin = c * rowsPerChunk;
+        idx_t end = min(begin + rowsPerChunk, rows);
+        memset(&matrix[begin * ld], 0, (end - begin) * ld * sizeof(T));
+    }
+}
+
+// Problem shape: C (M x N) = A (M x K) * B (K x N), with leading dimensions.
+struct Shape {
+    idx_t M, N, K;
+    idx_t lda, ldb, ldc;
+};
+
+// B is read by every thread, so spreading it the same way interleaves it across nodes.
+template <typename T, typename TC>
+bool matrixMemoryAllocation(T *&A, T *&B, TC *&C, const Shape &s, bool hugePages, idx_t rowsPerChunk) {
+  A = allocMatrix<T>((size_t)s.M * s.lda, hugePages);
+  B = allocMatrix<T>((size_t)s.K * s.ldb, hugePages);
+  C = allocMatrix<TC>((size_t)s.M * s.ldc, hugePages);
+  if (!A || !B || !C) {
+      cerr << "Error allocating matrices!" << endl;
+      return false;
+  }
+  firstTouch(A, s.M, s.lda, rowsPerChunk);
+  firstTouch(B, s.K, s.ldb, rowsPerChunk);
+  firstTouch(C, s.M, s.ldc, rowsPerChunk);
+  return true;
+}
+
+// dst = src converted to T, for running narrow dtypes on the f64 inputs.
+template <typename T>
+void convertMatrix(idx_t rows, idx_t cols, const double *src, idx_t lds, T *dst, idx_t ldd) {
+  #pragma omp parallel for schedule(static)
+  for (idx_t i = 0; i < rows; i++) {
+      for (idx_t j = 0; j < cols; j++) dst[i * ldd + j] = narrow<T>(src[i * lds + j]);
+  }
+}
+
+
+// Hot-path tracing, compiled in with -DCPD_TRACE (TRACE=1 ./script.sh) and
+// otherwise gone: TRACE_SPAN(name) records the enclosing scope as one span of
+// the calling thread, timed with the TSC (rdtsc; steady_clock elsewhere), while
+// traceStart() .. traceStop() is active. Names are string literals naming the
+// phase ("zero_c", "pack_a", "tile", "barrier", ...). Each thread appends to
+// its own buffer, so spans cost two clock reads and a store.
+#ifdef CPD_TRACE
+struct TraceEvent {
+    const char *name;
+    uint64_t start, end;
+};
+
+// Written by traceStart/traceStop while worker threads read it in every span.
+extern atomic<bool> traceOn;
+
+inline uint64_t traceClock() {
+#ifdef CPD_X86
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void traceRecord(const char *name, uint64_t start, uint64_t end);
+
+struct TraceSpan {
+    const char *name;
+    uint64_t start;
+    explicit TraceSpan(const char *n) : name(n), start(traceOn.load(memory_order_relaxed) ? traceClock() : 0) {}
+    ~TraceSpan() {
+        if (start) traceRecord(name, start, traceClock());
+    }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+// Clears every buffer and starts recording; traceStop() ends it and calibrates
+// the TSC against steady_clock over the recorded window.
+void traceStart();
+void traceStop();
+// Time in each phase over all threads, in seconds, and the number of spans.
+vector<pair<string, double>> tracePhaseTotals(size_t &events);
+// Writes the spans as Chrome trace JSON (chrome://tracing, ui.perfetto.dev):
+// one complete ("X") event per span, one track per thread.
+bool traceWriteChrome(const string &path);
+#else
+#define TRACE_SPAN(name) ((void)0)
+#endif
+
+// A barrier of the enclosing parallel region, traced as "barrier" so the
+// trace shows how long each thread waits for the others at it.
+void traceBarrier();
+
+
+// Packed GEMM blocking (BLIS/GotoBLAS scheme): a KC x NC panel of B is sized
+// for L3, an MC x KC panel of A for L2 and a KC x NR sliver of B for L1.
+// The MR x NR block of C stays in registers for the whole k loop.
+// MR/NR below are the scalar shape; each ISA's micro-kernel picks its own,
+// so MC and NC are multiples of every MR and NR in the dispatch table.
+#define GEMM_MR 6
+#define GEMM_NR 8
+#define GEMM_MR_MAX 8
+#define GEMM_NR_MAX 16
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 4096
+
+
+// Kernel table chosen once at startup from CPUID (or forced with --isa).
+struct Kernels {
+    const char *isa;
+    idx_t mr, nr;
+    void (*axpy)(idx_t, double, const double *, double *);
+    void (*rowTimesCols)(idx_t, const double *, const double *, idx_t, double *, idx_t);
+    double (*dot)(idx_t, const double *, const double *);
+    void (*microKernel)(idx_t, const double *, const double *, double *, idx_t, idx_t, idx_t);
+    void (*axpyf)(idx_t, float, const float *, float *);
+    void (*axpybf16)(idx_t, float, const bf16 *, float *);
+    double (*fmaProbe)(idx_t, double *);
+};
+
+extern Kernels kern;
+// Set once selectKernels has run; gemm() selects "auto" on its first call otherwise.
+extern bool kernelsSelected;
+
+// Picks the widest ISA the CPU supports, capped by the requested one ("auto" means no cap).
+bool selectKernels(const string &requested);
+
+
+// All kernels compute C = A * B for an M x K matrix A and a K x N matrix B,
+// row-major with leading dimensions lda, ldb and ldc (row strides in elements).
+
+// The simple, line and block kernels are templates on the input type T, with C
+// of type Accumulator<T>::type; the other kernels are double only.
+
+// Zeroes the M x N part of C, row by row when C is a view into a wider matrix.
+template <typename T>
+void zeroMatrix(idx_t M, idx_t N, T *phc, idx_t ldc) {
+    TRACE_SPAN("zero_c");
+    if (ldc == N) {
+        memset(phc, 0, (size_t)M * N * sizeof(T));
+        return;
+    }
+    for (idx_t i = 0; i < M; i++) memset(&phc[i * ldc], 0, N * sizeof(T));
+}
+
+// Row kernels by element type: the ISA table for each, overloaded so the templates pick the right one.
+inline void axpyRow(idx_t n, double a, const double *x, double *y) { kern.axpy(n, a, x, y); }
+inline void axpyRow(idx_t n, float a, const float *x, float *y) { kern.axpyf(n, a, x, y); }
+inline void axpyRow(idx_t n, float a, const bf16 *x, float *y) { kern.axpybf16(n, a, x, y); }
+
+inline void rowTimesColsRow(idx_t k, const double *a, const double *b, idx_t ldb, double *c, idx_t n) {
+    kern.rowTimesCols(k, a, b, ldb, c, n);
+}
+
+// Narrow types use the line order on one row, which keeps the inner loop on the
+// vectorised axpy instead of a strided dot product.
+template <typename T, typename TC>
+inline void rowTimesColsRow(idx_t k, const T *a, const T *b, idx_t ldb, TC *c, idx_t n) {
+    for (idx_t p = 0; p < k; p++) axpyRow(n, widen(a[p]), &b[p * ldb], c);
+}
+
+
+// Simple Matrix Multiplication
+template <typename T, typename TC>
+void OnMult(idx_t M, idx_t N, idx_t K, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc) {
+    zeroMatrix(M, N, phc, ldc);
+
+    for (idx_t i = 0; i < M; i++) {
+        rowTimesColsRow(K, &pha[i * lda], phb, ldb, &phc[i * ldc], N);
+    }
+}
+
+
+// Line Matrix Multiplication
+template <typename T, typename TC>
+void OnMultLine(idx_t M, idx_t N, idx_t K, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc) {
+    zeroMatrix(M, N, phc, ldc);
+
+    for (idx_t i = 0; i < M; i++) {
+        for (idx_t k = 0; k < K; k++) {
+            TC temp = widen(pha[i * lda + k]);
+            axpyRow(N, temp, &phb[k * ldb], &phc[i * ldc]);
+        }
+    }
+}
+
+// Parallel Line Matrix Multiplication: the i-k-j order of OnMultLine with rows
+// split across threads. The inner loop walks a row of B and a row of C with
+// stride 1, which is what makes the line kernels fast.
+template <typename T, typename TC>
+void OnMultLine_parallel_1(idx_t M, idx_t N, idx_t K, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc) {
+    zeroMatrix(M, N, phc, ldc);
+    #pragma omp parallel
+    {
+        #pragma omp for schedule(static) nowait
+        for (idx_t i = 0; i < M; i++) {
+            TRACE_SPAN("row");
+            for (idx_t k = 0; k < K; k++) {
+                axpyRow(N, widen(pha[i * lda + k]), &phb[k * ldb], &phc[i * ldc]);
+            }
+        }
+        traceBarrier();
+    }
+}
+
+
+// Widest column tile of the 2D line decomposition; a tile of B rows this
+// wide stays in L1/L2 while one row of A streams over it.
+#define LINE_TILE_COLS 64
+
+// 2D work decomposition: every (row, column tile) pair is one iteration of a
+// single collapsed loop, so there is still work for every thread when threads
+// outnumber rows. Each C tile is accumulated privately by the thread that owns
+// it, with no nested parallel region or reduction per element.
+template <typename T, typename TC>
+void OnMultLine_parallel_2(idx_t M, idx_t N, idx_t K, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc) {
+    zeroMatrix(M, N, phc, ldc);
+
+    // Narrow the tiles until there are about four work items per thread.
+    idx_t threads = omp_get_max_threads();
+    idx_t tilesPerRow = (4 * threads + M - 1) / M;
+    idx_t tileCols = max<idx_t>(1, min<idx_t>(LINE_TILE_COLS, (N + tilesPerRow - 1) / tilesPerRow));
+
+    #pragma omp parallel
+    {
+        #pragma omp for collapse(2) schedule(static) nowait
+        for (idx_t i = 0; i < M; i++) {
+            for (idx_t jj = 0; jj < N; jj += tileCols) {
+                TRACE_SPAN("tile");
+                idx_t cols = min(tileCols, N - jj);
+                for (idx_t k = 0; k < K; k++) {
+                    axpyRow(cols, widen(pha[i * lda + k]), &phb[k * ldb + jj], &phc[i * ldc + jj]);
+                }
+            }
+        }
+        traceBarrier();
+    }
+}
+
+// Work-stealing tile scheduler, for cores of unequal speed or busy hosts where
+// a static split waits for the slowest thread. Tiles 0..count-1 are dealt out
+// in contiguous ranges, one deque per thread; a thread runs tiles from the
+// front of its own deque and, once it is empty, steals the back half of
+// another thread's. busy is each thread's time inside tiles, idle the rest of
+// the region (scheduling, stealing and the wait at its end).
+struct StealStats {
+    vector<double> busy, idle;
+    vector<long long> tiles, steals;
+};
+
+void runTilesStealing(idx_t count, const function<void(idx_t)> &tile, StealStats &stats);
+
+// The (row, column tile) items of OnMultLine_parallel_2 on the stealing scheduler.
+template <typename T, typename TC>
+void OnMultLine_stealing(idx_t M, idx_t N, idx_t K, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc, StealStats &stats) {
+    zeroMatrix(M, N, phc, ldc);
+    idx_t tilesPerRow = (N + LINE_TILE_COLS - 1) / LINE_TILE_COLS;
+    runTilesStealing(M * tilesPerRow, [&](idx_t t) {
+        idx_t i = t / tilesPerRow, jj = (t % tilesPerRow) * LINE_TILE_COLS;
+        idx_t cols = min<idx_t>(LINE_TILE_COLS, N - jj);
+        for (idx_t k = 0; k < K; k++) {
+            axpyRow(cols, widen(pha[i * lda + k]), &phb[k * ldb + jj], &phc[i * ldc + jj]);
+        }
+    }, stats);
+}
+
+// Tile edge of the blocked transpose and of the dot-product kernel.
+#define DOT_TILE 64
+
+// dst = src^T for a rows x cols src, copied tile by tile so both the reads
+// and the writes of a tile stay within a few cache lines per row.
+void transposeBlocked(idx_t rows, idx_t cols, const double *src, idx_t lds, double *dst, idx_t ldd);
+
+// Dot-product Matrix Multiplication on a pre-transposed B (phbT = B^T, N x K):
+// every C element is a contiguous dot product of a row of A and a row of B^T.
+// Work is tiled so a DOT_TILE block of B^T rows is reused across DOT_TILE rows of A.
+void OnMultDot(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phbT, idx_t ldbt, double *phc, idx_t ldc, bool parallel);
+
+
+// Order of the tile loops of the blocked kernels. TILE_IJK keeps one C tile
+// hot across the whole k loop; TILE_IKJ sweeps a row panel of C per k tile.
+enum TileOrder { TILE_IJK, TILE_IKJ };
+
+// Block sizes of the blocked kernels, one per loop dimension, and the tile loop order.
+struct BlockSizes {
+    idx_t m, n, k;
+    TileOrder order;
+};
+
+// C[i0:i1, j0:j1] += A[i0:i1, k0:k1] * B[k0:k1, j0:j1]
+template <typename T, typename TC>
+inline void tileAccumulate(idx_t i0, idx_t i1, idx_t j0, idx_t j1, idx_t k0, idx_t k1, const T *pha, idx_t lda, const T *phb, idx_t ldb, TC *phc, idx_t ldc) {
+  for (idx_t i = i0; i < i1; i++) {
+    for (idx_t k = k0; k < k1; k++) {
+      TC pha_val = widen(pha[i * lda + k]);
+      axpyRow(j1 - j0, pha_val, &phb[k * ldb + j0], &phc[i * ldc + j0]);
+    }
+  }
+}
+
+// C += A * B over bk tiles. Each (ii, jj) pair owns one tile of C, so when
+// the two tile loops are split across threads no two threads write the same tile.
+// In TILE_IKJ order each thread owns whole row panels instead.
+template <typename T, typename TC>
+void blockAccumulate(idx_t M, idx_t N, idx_t K, BlockSizes bk, const T *pha, idx_t lda, const T *phb, idx_t ldb, TC *phc, idx_t ldc, bool parallel) {
+  #pragma omp parallel if(parallel)
+  {
+    if (bk.order == TILE_IKJ) {
+      #pragma omp for schedule(static) nowait
+      for (idx_t ii = 0; ii < M; ii += bk.m) {
+        TRACE_SPAN("panel");
+        for (idx_t kk = 0; kk < K; kk += bk.k) {
+          for (idx_t jj = 0; jj < N; jj += bk.n) {
+            tileAccumulate(ii, min(ii + bk.m, M), jj, min(jj + bk.n, N), kk, min(kk + bk.k, K), pha, lda, phb, ldb, phc, ldc);
+          }
+        }
+      }
+    } else {
+      #pragma omp for collapse(2) schedule(static) nowait
+      for (idx_t ii = 0; ii < M; ii += bk.m) {
+        for (idx_t jj = 0; jj < N; jj += bk.n) {
+          TRACE_SPAN("tile");
+          for (idx_t kk = 0; kk < K; kk += bk.k) {
+            tileAccumulate(ii, min(ii + bk.m, M), jj, min(jj + bk.n, N), kk, min(kk + bk.k, K), pha, lda, phb, ldb, phc, ldc);
+          }
+        }
+      }
+    }
+    traceBarrier();
+  }
+}
+
+// blockAccumulate with its C tiles (row panels in TILE_IKJ order) on the stealing scheduler.
+template <typename T, typename TC>
+void blockAccumulateStealing(idx_t M, idx_t N, idx_t K, BlockSizes bk, const T *pha, idx_t lda, const T *phb, idx_t ldb, TC *phc, idx_t ldc, StealStats &stats) {
+  idx_t tilesM = (M + bk.m - 1) / bk.m, tilesN = bk.order == TILE_IKJ ? 1 : (N + bk.n - 1) / bk.n;
+  runTilesStealing(tilesM * tilesN, [&](idx_t t) {
+    idx_t ii = (t / tilesN) * bk.m, i1 = min(ii + bk.m, M);
+    if (bk.order == TILE_IKJ) {
+      for (idx_t kk = 0; kk < K; kk += bk.k) {
+        for (idx_t jj = 0; jj < N; jj += bk.n) {
+          tileAccumulate(ii, i1, jj, min(jj + bk.n, N), kk, min(kk + bk.k, K), pha, lda, phb, ldb, phc, ldc);
+        }
+      }
+      return;
+    }
+    idx_t jj = (t % tilesN) * bk.n;
+    for (idx_t kk = 0; kk < K; kk += bk.k) {
+      tileAccumulate(ii, i1, jj, min(jj + bk.n, N), kk, min(kk + bk.k, K), pha, lda, phb, ldb, phc, ldc);
+    }
+  }, stats);
+}
+
+// Block Matrix Multiplication
+template <typename T, typename TC>
+void OnMultBlock(idx_t M, idx_t N, idx_t K, BlockSizes bk, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc) {
+  zeroMatrix(M, N, phc, ldc);
+  blockAccumulate(M, N, K, bk, pha, lda, phb, ldb, phc, ldc, false);
+}
+
+
+// Parallel Block Matrix Multiplication
+// Both tile loops are collapsed, so tall-skinny and short-wide shapes split
+// along whichever dimension has the tiles.
+template <typename T, typename TC>
+void OnMultBlock_parallel(idx_t M, idx_t N, idx_t K, BlockSizes bk, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc) {
+  zeroMatrix(M, N, phc, ldc);
+  blockAccumulate(M, N, K, bk, pha, lda, phb, ldb, phc, ldc, true);
+}
+
+// Parallel Block Matrix Multiplication with work stealing between the threads.
+template <typename T, typename TC>
+void OnMultBlock_stealing(idx_t M, idx_t N, idx_t K, BlockSizes bk, T *pha, idx_t lda, T *phb, idx_t ldb, TC *phc, idx_t ldc, StealStats &stats) {
+  zeroMatrix(M, N, phc, ldc);
+  blockAccumulateStealing(M, N, K, bk, pha, lda, phb, ldb, phc, ldc, stats);
+}
+
+
+// Sparse and structured A (f64). CSR keeps the nonzeros of each row in
+// column order: row i owns val/col[rowStart[i] .. rowStart[i + 1]).
+struct CsrMatrix {
+    idx_t rows, cols;
+    vector<idx_t> rowStart, col;
+    vector<double> val;
+};
+
+// The nonzeros of a dense rows x cols matrix.
+CsrMatrix denseToCsr(idx_t rows, idx_t cols, const double *A, idx_t lda);
+
+// C = A * B for a CSR A (SpMM): every nonzero scales one row of B into a row
+// of C. In parallel the rows are split into one contiguous range per thread
+// holding about the same number of nonzeros, so dense rows do not pile up on one.
+void OnMultCsr(const CsrMatrix &A, idx_t N, const double *phb, idx_t ldb, double *phc, idx_t ldc, bool parallel);
+
+// C = A * B for an M x M symmetric A of which only the upper triangle (j >= i)
+// is read; entries below the diagonal are taken from their mirror. Tiled as
+// blockAccumulate in TILE_IJK order.
+void OnMultSymmetric(idx_t M, idx_t N, BlockSizes bk, const double *pha, idx_t lda, const double *phb, idx_t ldb,
+                     double *phc, idx_t ldc, bool parallel);
+
+// C = A * B for an M x M upper triangular A: tiles and rows below the diagonal
+// are skipped, so A's lower half is never read and half the flops are done.
+// Row tiles near the top carry more work, so threads take tiles dynamically.
+void OnMultTriangular(idx_t M, idx_t N, BlockSizes bk, const double *pha, idx_t lda, const double *phb, idx_t ldb,
+                      double *phc, idx_t ldc, bool parallel);
+
+
+// Loop-nest variants: the three point loops in any order, optionally tiled,
+// with the innermost loop unrolled. Order, unroll factor and tile sizes are
+// template parameters, so every instantiation is a fully specialised kernel;
+// loopVariants below is the registry the mode argument looks names up in.
+enum LoopIndex { LOOP_I, LOOP_J, LOOP_K };
+
+// C[i0:i1, j0:j1] += A[i0:i1, k0:k1] * B[k0:k1, j0:j1], loops nested Outer, Middle, Inner.
+template <int Outer, int Middle, int Inner, int Unroll>
+inline void variantTile(idx_t i0, idx_t i1, idx_t j0, idx_t j1, idx_t k0, idx_t k1,
+                        const double *pha, idx_t lda, const double *phb, idx_t ldb, double *phc, idx_t ldc) {
+  const idx_t lo[3] = {i0, j0, k0}, hi[3] = {i1, j1, k1};
+  idx_t x[3];
+  for (x[Outer] = lo[Outer]; x[Outer] < hi[Outer]; x[Outer]++) {
+    for (x[Middle] = lo[Middle]; x[Middle] < hi[Middle]; x[Middle]++) {
+      x[Inner] = lo[Inner];
+      const double *a = &pha[x[LOOP_I] * lda + x[LOOP_K]];
+      const double *b = &phb[x[LOOP_K] * ldb + x[LOOP_J]];
+      double *c = &phc[x[LOOP_I] * ldc + x[LOOP_J]];
+      idx_t n = hi[Inner] - lo[Inner], t = 0;
+      if (Inner == LOOP_K) {
+        // Dot product down a column of B.
+        double sum = *c;
+        for (; t + Unroll <= n; t += Unroll)
+          for (int u = 0; u < Unroll; u++) sum += a[t + u] * b[(t + u) * ldb];
+        for (; t < n; t++) sum += a[t] * b[t * ldb];
+        *c = sum;
+      } else if (Inner == LOOP_J) {
+        // Row of B scaled into a row of C.
+        double av = *a;
+        for (; t + Unroll <= n; t += Unroll)
+          for (int u = 0; u < Unroll; u++) c[t + u] += av * b[t + u];
+        for (; t < n; t++) c[t] += av * b[t];
+      } else {
+        // Column of A scaled into a column of C.
+        double bv = *b;
+        for (; t + Unroll <= n; t += Unroll)
+          for (int u = 0; u < Unroll; u++) c[(t + u) * ldc] += a[(t + u) * lda] * bv;
+        for (; t < n; t++) c[t * ldc] += a[t * lda] * bv;
+      }
+    }
+  }
+}
+
+// C = A * B with the tile loops nested in the same order as the point loops.
+// A tile size of 0 leaves that dimension untiled, so <.., 0, 0, 0> is the plain loop nest.
+template <int Outer, int Middle, int Inner, int Unroll, idx_t TI, idx_t TJ, idx_t TK>
+void OnMultVariant(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phb, idx_t ldb, double *phc, idx_t ldc) {
+  zeroMatrix(M, N, phc, ldc);
+  const idx_t dim[3] = {M, N, K};
+  const idx_t tile[3] = {TI > 0 ? TI : M, TJ > 0 ? TJ : N, TK > 0 ? TK : K};
+  idx_t x[3];
+  for (x[Outer] = 0; x[Outer] < dim[Outer]; x[Outer] += tile[Outer]) {
+    for (x[Middle] = 0; x[Middle] < dim[Middle]; x[Middle] += tile[Middle]) {
+      for (x[Inner] = 0; x[Inner] < dim[Inner]; x[Inner] += tile[Inner]) {
+        variantTile<Outer, Middle, Inner, Unroll>(x[0], min(x[0] + tile[0], M), x[1], min(x[1] + tile[1], N),
+                                                  x[2], min(x[2] + tile[2], K), pha, lda, phb, ldb, phc, ldc);
+      }
+    }
+  }
+}
+
+#define VARIANT_UNROLL 4
+#define VARIANT_TI 64
+#define VARIANT_TJ 256
+#define VARIANT_TK 256
+
+struct LoopVariant {
+    const char *name;
+    void (*run)(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phb, idx_t ldb, double *phc, idx_t ldc);
+};
+
+#define LOOP_VARIANTS(prefix, ti, tj, tk) \
+    {prefix "ijk", OnMultVariant<LOOP_I, LOOP_J, LOOP_K, VARIANT_UNROLL, ti, tj, tk>}, \
+    {prefix "ikj", OnMultVariant<LOOP_I, LOOP_K, LOOP_J, VARIANT_UNROLL, ti, tj, tk>}, \
+    {prefix "jik", OnMultVariant<LOOP_J, LOOP_I, LOOP_K, VARIANT_UNROLL, ti, tj, tk>}, \
+    {prefix "jki", OnMultVariant<LOOP_J, LOOP_K, LOOP_I, VARIANT_UNROLL, ti, tj, tk>}, \
+    {prefix "kij", OnMultVariant<LOOP_K, LOOP_I, LOOP_J, VARIANT_UNROLL, ti, tj, tk>}, \
+    {prefix "kji", OnMultVariant<LOOP_K, LOOP_J, LOOP_I, VARIANT_UNROLL, ti, tj, tk>}
+extern const vector<LoopVariant> loopVariants;
+
+
+// Packs an mc x kc block of alpha * A into MR-row panels, column by column.
+// Rows past mc are zero-filled so the micro-kernel never needs a bound check.
+void packA(idx_t mc, idx_t kc, double alpha, const double *A, idx_t lda, double *Ap, idx_t MR);
+
+// Packs a kc x nc block of B into NR-column slivers, row by row.
+void packB(idx_t kc, idx_t nc, const double *B, idx_t ldb, double *Bp, idx_t NR);
+
+// Packed Matrix Multiplication
+// In parallel runs the split follows the shape: with at least one MC row panel
+// per thread each thread packs and multiplies its own A panels; otherwise (short
+// or tall-skinny-transposed shapes) the A panel is packed once and the NR-column
+// slivers of the B panel are split instead.
+void OnMultPacked(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phb, idx_t ldb, double *phc, idx_t ldc, bool parallel);
+
+
+// Small-matrix kernels of the batched mode: C = alpha * A * B + beta * C on one
+// whole problem, with no tiling, packing or zeroing pass. Square sizes listed in
+// smallKernels have a fixed-size kernel per ISA whose trip counts are all
+// compile-time constants; other shapes take smallGemm.
+typedef void (*SmallKernel)(const double *A, idx_t lda, const double *B, idx_t ldb, double *C, idx_t ldc,
+                            double alpha, double beta);
+
+// Fixed-size kernel of the selected ISA for an M x N x K problem, or nullptr.
+SmallKernel smallKernelFor(idx_t M, idx_t N, idx_t K);
+// Any shape: the line order on the ISA axpy, one row of C at a time.
+void smallGemm(idx_t M, idx_t N, idx_t K, double alpha, const double *A, idx_t lda, const double *B, idx_t ldb,
+               double beta, double *C, idx_t ldc);
+
+
+// Strassen-Winograd recursion: 7 half-size products and 15 additions per level
+// instead of 8 products. Odd dimensions are peeled off and fixed up with the
+// blocked kernel, which is also the base case below the cutoff. All
+// temporaries come from one arena sized up front by strassenWorkspace. The top
+// taskDepth levels run their seven products as OpenMP tasks, each with its own
+// slice of the arena; deeper levels run them in turn and share one slice.
+
+struct StrassenConfig {
+    idx_t cutoff;
+    int taskDepth;
+    BlockSizes bk;
+};
+
+// Doubles of arena needed by strassenRec for this shape at this depth.
+size_t strassenWorkspace(idx_t M, idx_t N, idx_t K, const StrassenConfig &cfg, int depth);
+
+// Strassen-Winograd Matrix Multiplication; arena must hold strassenWorkspace(M, N, K, cfg, 0) doubles.
+void OnMultStrassen(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phb, idx_t ldb, double *phc, idx_t ldc,
+                    const StrassenConfig &cfg, double *arena, bool parallel);
+
+
+// Cache-oblivious recursive multiplication: the problem, counted in
+// REC_TILE x REC_TILE tiles, is halved along its largest dimension until one
+// tile of each operand is left, so every cache level ends up holding some
+// level of the recursion without a tuned block size. Splits of M and N write
+// disjoint halves of C and become OpenMP tasks; a split of K runs its halves
+// in turn. Operands are either used in place or converted to a Morton (Z-order)
+// tiled layout, in which each tile is contiguous and the tiles of every
+// recursive quadrant are adjacent in memory.
+#define REC_TILE 32
+// Sub-problems of fewer tile products than this are not split into tasks.
+#define REC_TASK_MIN 512
+// Morton tiles are spaced one cache line more than their size apart; with
+// power-of-two spacing the A, B and C tiles of a product would alias in the
+// L1 sets and in the 4K store-forwarding check.
+#define REC_TILE_STRIDE (REC_TILE * REC_TILE + CACHE_LINE_BYTES / sizeof(double))
+
+// A matrix seen as a grid of REC_TILE tiles: row-major in place, or Morton
+// tiles at offset[tr * tilesC + tc], each zero-padded to a full tile.
+struct TiledView {
+    double *data;
+    idx_t rows, cols, ld;
+    idx_t tilesR, tilesC;
+    bool morton;
+    vector<size_t> offset;
+
+    double *tile(idx_t tr, idx_t tc, idx_t &ldt) const {
+        if (morton) {
+            ldt = REC_TILE;
+            return data + offset[tr * tilesC + tc];
+        }
+        ldt = ld;
+        return data + tr * REC_TILE * ld + tc * REC_TILE;
+    }
+
+    // Extent of a tile: the clipped edge in place, the whole padded tile in Morton layout.
+    idx_t tileRows(idx_t tr) const { return morton ? REC_TILE : min<idx_t>(REC_TILE, rows - tr * REC_TILE); }
+    idx_t tileCols(idx_t tc) const { return morton ? REC_TILE : min<idx_t>(REC_TILE, cols - tc * REC_TILE); }
+};
+
+TiledView rowMajorView(double *data, idx_t rows, idx_t cols, idx_t ld);
+
+// Allocates a Morton-layout view of a rows x cols matrix. Tiles are numbered
+// by their Morton code, skipping the codes of the power-of-two grid that fall
+// outside the matrix, so non-square and non-power-of-two shapes stay compact.
+bool allocMortonView(idx_t rows, idx_t cols, TiledView &v);
+
+// Row-major src into the Morton view dst, and back. The padding keeps its zeros.
+void toMorton(const double *src, idx_t lds, TiledView &dst);
+void fromMorton(const TiledView &src, double *dst, idx_t ldd);
+
+// Recursive Matrix Multiplication on tiled views (row-major or Morton).
+void OnMultRecursive(const TiledView &A, const TiledView &B, const TiledView &C, bool parallel);
+
+
+// Out-of-core streaming: A, B and C are files mapped with mmap. C is produced
+// one panel of panelM rows at a time; the matching rows of A are staged once per
+// panel and B is streamed through in panels of panelK rows. Each matrix has two
+// staging buffers, so a helper thread reads the next panel from disk while the
+// current one goes through the blocked kernel.
+
+struct MappedMatrix {
+    void *base;
+    double *data;
+    size_t bytes;
+    int fd;
+};
+
+// Maps a rows x cols matrix file of doubles in the headered format below. A
+// file whose header does not match the shape and seed (or that has none) is
+// rewritten with a new header; created tells the caller the contents must
+// then be generated. Outputs pass MATRIX_SEED_NONE.
+bool mapMatrixFile(const string &path, idx_t rows, idx_t cols, uint64_t seed, bool writable, MappedMatrix &m, bool &created);
+void unmapMatrixFile(MappedMatrix &m);
+
+// Headered matrix files: a 64-byte header, then rows x ld elements in
+// row-major order from dataOffset, a multiple of alignment (one page when
+// written here), so mapping the file hands the kernels an aligned matrix
+// without a copy. Integers are little-endian, as on every host this runs on.
+#define MATRIX_FILE_MAGIC "CPDMAT01"
+#define MATRIX_SEED_NONE UINT64_MAX
+
+enum MatrixDtype : uint32_t { DTYPE_F64 = 0, DTYPE_F32 = 1, DTYPE_BF16 = 2 };
+enum MatrixLayout : uint32_t { LAYOUT_ROW_MAJOR = 0 };
+
+struct MatrixFileHeader {
+    char magic[8];
+    uint32_t dtype, layout;
+    uint64_t rows, cols, ld, dataOffset, alignment;
+    // The --seed the contents were generated from, MATRIX_SEED_NONE otherwise.
+    uint64_t seed;
+};
+static_assert(sizeof(MatrixFileHeader) == 64, "the matrix file header is 64 bytes");
+
+struct MatrixFile {
+    MatrixFileHeader header;
+    void *base;
+    size_t bytes;
+    double *data;
+};
+
+// Maps an f64 matrix file read-only, reading it in (MAP_POPULATE) so the
+// kernels do not take its page faults. Reports what is wrong with other files.
+bool loadMatrixFile(const string &path, MatrixFile &f);
+void closeMatrixFile(MatrixFile &f);
+
+// Writes the rows x cols part of a matrix as a tightly packed file (ld = cols).
+bool saveMatrixFile(const string &path, idx_t rows, idx_t cols, const double *matrix, idx_t ld);
+bool saveMatrixFile(const string &path, idx_t rows, idx_t cols, const float *matrix, idx_t ld);
+
+// Time the compute threads spent blocked on panel reads, and in the kernel.
+struct StreamTimes {
+    double wait, compute;
+};
+
+// Streaming Matrix Multiplication of tightly packed M x K and K x N mappings.
+StreamTimes OnMultStream(idx_t M, idx_t N, idx_t K, BlockSizes bk, idx_t panelM, idx_t panelK,
+                         const double *pha, const double *phb, double *phc, bool parallel);
+
+
+// Offload to the default OpenMP target device: every team computes one
+// DEV_TILE x DEV_TILE tile of C, staging tiles of A and B in team-shared
+// memory. Without a device the target region runs on the host (libgomp's
+// fallback), which is correct but slow.
+#define DEV_TILE 16
+
+// Time spent copying the operands to the device, in the kernel, and copying C back.
+struct DeviceTimes {
+    double h2d, kernel, d2h;
+};
+
+bool deviceAvailable();
+
+// C = alpha * A * B + beta * C on the device; with beta = 0 C is not copied in.
+DeviceTimes OnMultDevice(idx_t M, idx_t N, idx_t K, double alpha, const double *A, idx_t lda,
+                         const double *B, idx_t ldb, double beta, double *C, idx_t ldc);
+
+#endif
@@ -1,181 +1,1865 @@
-#include <chrono>
-#include <cstdlib>
-#include <cstring>
-#include <ctime>
-#include <iostream>
-#include <vector>
-#include <functional>
-#include <fstream>
-#include <numeric>
-#include <algorithm>
-#include <omp.h>
-#include <papi.h>
-
-using namespace std;
-using namespace chrono;
-
-// PAPI events definition
-#define NUM_EVENTS 4
-int events[NUM_EVENTS] = {PAPI_L1_DCM, PAPI_L2_DCM, PAPI_L3_TCM, PAPI_DP_OPS};
-
-// Function to initialize PAPI
-void initPAPI() {
-    if (PAPI_library_init(PAPI_VER_CURRENT) != PAPI_VER_CURRENT) {
-        cerr << "Error initializing PAPI!" << endl;
-        exit(1);
-    }
-}
-
-void generateRandomMatrix(double *matrix, int size) {
-  for (int i = 0; i < size * size; i++) {
-      matrix[i] = (double)(rand() % 10 + 1);
-  }
-}
-
-bool matrixMemoryAllocation(double *&A, double *&B, double *&C, int size) {
-  A = new double[size * size];
-  B = new double[size * size];
-  C = new double[size * size];
-  return A && B && C;
-}
-
-
-// Simple Matrix Multiplication
-void OnMult(int m_ar, int m_br, double *pha, double *phb, double *phc) {
-    memset(phc, 0, m_ar * m_br * sizeof(double));
-
-    for (int i = 0; i < m_ar; i++) {
-        for (int j = 0; j < m_br; j++) {
-            double sum = 0.0;
-            for (int k = 0; k < m_ar; k++) {
-                sum += pha[i * m_ar + k] * phb[k * m_br + j];
-            }
-            phc[i * m_ar + j] = sum;
-        }
-    }
-}
-
-
-// Line Matrix Multiplication
-void OnMultLine(int m_ar, int m_br, double *pha, double *phb, double *phc) {
-  memset(phc, 0, m_ar * m_br * sizeof(double));
-
-    for (int i = 0; i < m_ar; i++) {
-        for (int j = 0; j < m_br; j++) {
-            double temp = pha[i * m_ar + j];
-            for (int k = 0; k < m_ar; k++) {
-                phc[i * m_ar + k] += temp * phb[j * m_br + k];
-            }
-        }
-    }
-}
-
-void OnMultLine_parallel_1(int m_ar, int m_br, double *pha, double *phb, double *phc) {
-    memset(phc, 0, m_ar * m_br * sizeof(double));
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < m_ar; i++) {
-        for (int j = 0; j < m_br; j++) {
-            double sum = 0.0;
-            for (int k = 0; k < m_ar; k++) {
-                sum += pha[i * m_ar + k] * phb[j * m_br + k];
-            }
-            phc[i * m_ar + j] = sum;
-        }
-    }
-}
-
-
-void OnMultLine_parallel_2(int m_ar, int m_br, double *pha, double *phb, double *phc) {
-    memset(phc, 0, m_ar * m_br * sizeof(double));
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < m_ar; i++) {
-        for (int j = 0; j < m_br; j++) {
-            double sum = 0.0;
-            #pragma omp parallel for schedule(static,10) reduction(+:sum)
-            for (int k = 0; k < m_ar; k++) {
-                sum += pha[i * m_ar + k] * phb[j * m_br + k];
-            }
-            phc[i * m_ar + j] = sum;
-        }
-    }
-}
-
-// Block Matrix Multiplication
-void OnMultBlock(int m_ar, int m_br, int bkSize, double *pha, double *phb, double *phc) {
-  memset(phc, 0, m_ar * m_br * sizeof(double));
-
-  for (int ii = 0; ii < m_ar; ii += bkSize) {
-    for (int jj = 0; jj < m_br; jj += bkSize) {
-      for (int kk = 0; kk < m_ar; kk += bkSize) {
-        for (int i = ii; i < min(ii + bkSize, m_ar); i++) {
-          for (int k = kk; k < min(kk + bkSize, m_ar); k++) {
-            double pha_val = pha[i * m_ar + k];
-            for (int j = jj; j < min(jj + bkSize, m_br); j++) {
-              phc[i * m_ar + j] += pha_val * phb[k * m_br + j];
-            }
-          }
-        }
-      }
-    }
-  }
-}
-
-
-int main(int argc, char *argv[]) {
-  if (argc < 5) {
-      cerr << "Usage: ./multiplication <mode> <size> <dummy_iteration> <parallel_flag> [block_size]" << endl;
-      return 1;
-  }
-
-  int mode = atoi(argv[1]);
-  int size = atoi(argv[2]);
-  // The dummy iteration parameter is ignored; each execution performs only one iteration.
-  bool parallel_1 = (atoi(argv[4]) == 1);
-  bool parallel_2 = (atoi(argv[4]) == 2);
-  int blockSize = (argc == 6) ? atoi(argv[5]) : -1;
-
-  // Initialize PAPI
-  initPAPI();
-
-  double *A, *B, *C;
-  if (!matrixMemoryAllocation(A, B, C, size)) return 1;
-  generateRandomMatrix(A, size);
-  generateRandomMatrix(B, size);
-
-  long long values[NUM_EVENTS] = {0};
-  int EventSet = PAPI_NULL;
-  PAPI_create_eventset(&EventSet);
-  PAPI_add_events(EventSet, events, NUM_EVENTS);
-  PAPI_start(EventSet);
-
-  auto start = high_resolution_clock::now();
-  if (mode == 1) {
-      OnMult(size, size, A, B, C);
-  } else if (mode == 2) {
-      if (parallel_1) {
-          OnMultLine_parallel_1(size, size, A, B, C);
-      } 
-      else if (parallel_2) {
-          OnMultLine_parallel_2(size, size, A, B, C);
-      }
-      else {
-          OnMultLine(size, size, A, B, C);
-      }
-  } else if (mode == 3) {
-      OnMultBlock(size, size, blockSize, A, B, C);
-  }
-  auto end = high_resolution_clock::now();
-  PAPI_stop(EventSet, values);
-
-  double execution_time = duration<double>(end - start).count();
- 
-  // Print results in CSV format to stdout.
-  cout << "Matrix Size,Time,MFLOPS,L1_misses,L2_misses,L3_misses" << endl;
-  cout << size << "," << execution_time << "," << values[3] << "," << values[0] << "," << values[1] << "," << values[2] << endl;
-
-  delete[] A;
-  delete[] B;
-  delete[] C;
-
-  return 0;
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <map>
+#include <set>
+#include <tuple>
+#include <string>
+#include <cctype>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <omp.h>
+#include <papi.h>
+#include "kernels.h"
+#ifdef CPD_MPI
+#include "summa.h"
+#endif
+
+using namespace std;
+using namespace chrono;
+
+// PAPI events definition: the default --papi-events list, and the historical
+// CSV column names of those events (other events are reported under their own name).
+#define DEFAULT_EVENTS "PAPI_L1_DCM,PAPI_L2_DCM,PAPI_L3_TCM,PAPI_DP_OPS"
+const vector<pair<string, string>> eventColumns = {{"PAPI_L1_DCM", "L1_misses"}, {"PAPI_L2_DCM", "L2_misses"},
+                                                   {"PAPI_L3_TCM", "L3_misses"}, {"PAPI_DP_OPS", "DP_OPS"}};
+
+string eventColumn(const string &event) {
+    for (const auto &c : eventColumns) if (c.first == event) return c.second;
+    return event;
+}
+
+// Function to initialize PAPI. Counters are per OS thread, identified by pthread_self.
+void initPAPI() {
+    if (PAPI_library_init(PAPI_VER_CURRENT) != PAPI_VER_CURRENT) {
+        cerr << "Error initializing PAPI!" << endl;
+        exit(1);
+    }
+    if (PAPI_thread_init((unsigned long (*)(void))pthread_self) != PAPI_OK) {
+        cerr << "Error initializing PAPI thread support!" << endl;
+        exit(1);
+    }
+}
+
+// One EventSet per OpenMP thread. start() and stop() run a parallel region over
+// the current team so every worker starts and reads its own counters (libgomp
+// keeps the same OS thread at each team position between regions). With onPool
+// the sets belong to the gemm() worker pool instead, worker by worker. With more
+// events than hardware counters the sets are multiplexed, which time-slices the
+// counters and scales the counts up, so short runs get noisier values.
+struct ThreadCounters {
+    vector<string> names;
+    vector<int> codes;
+    vector<int> sets;
+    vector<vector<long long>> values;
+    bool multiplexed = false;
+    bool onPool = false;
+    int team = 1;
+
+    // Runs fn(t) on threads t = 0..threads-1 of the OpenMP team, or on every pool worker.
+    void onEachThread(int threads, const function<void(int)> &fn) {
+        if (onPool) {
+            gemmForEachWorker(fn);
+            return;
+        }
+        #pragma omp parallel num_threads(threads)
+        fn(omp_get_thread_num());
+    }
+
+    // Resolves the event names and builds a set on each of threads threads.
+    // Events the first set rejects are dropped with a warning.
+    bool init(const vector<string> &eventList, int threads) {
+        for (const string &name : eventList) {
+            int code;
+            if (PAPI_event_name_to_code(name.c_str(), &code) != PAPI_OK) {
+                cerr << "Unknown PAPI event '" << name << "'." << endl;
+                return false;
+            }
+            names.push_back(name);
+            codes.push_back(code);
+        }
+        int hwCounters = PAPI_num_cmp_hwctrs(0);
+        multiplexed = hwCounters > 0 && (int)codes.size() > hwCounters;
+        if (multiplexed && PAPI_multiplex_init() != PAPI_OK) {
+            cerr << "Warning: PAPI multiplexing unavailable, events past the " << hwCounters << " counters may fail." << endl;
+            multiplexed = false;
+        }
+
+        sets.assign(threads, PAPI_NULL);
+        values.assign(threads, vector<long long>());
+        // The first set decides which events are kept; the workers then add the same list.
+        sets[0] = createSet(true);
+        onEachThread(threads, [&](int t) {
+            if (t == 0) return;
+            PAPI_register_thread();
+            sets[t] = createSet(false);
+        });
+        bool ok = count(sets.begin(), sets.end(), PAPI_NULL) == 0;
+        for (auto &v : values) v.assign(codes.size(), 0);
+        if (!ok) cerr << "Error creating the per-thread PAPI event sets!" << endl;
+        return ok;
+    }
+
+    int createSet(bool pruneEvents) {
+        int set = PAPI_NULL;
+        if (PAPI_create_eventset(&set) != PAPI_OK) return PAPI_NULL;
+        if (multiplexed) {
+            PAPI_assign_eventset_component(set, 0);
+            PAPI_set_multiplex(set);
+        }
+        for (size_t e = 0; e < codes.size(); e++) {
+            if (PAPI_add_event(set, codes[e]) == PAPI_OK) continue;
+            if (!pruneEvents) return PAPI_NULL;
+            cerr << "Warning: PAPI event " << names[e] << " cannot be counted here and is skipped." << endl;
+            names.erase(names.begin() + e);
+            codes.erase(codes.begin() + e);
+            e--;
+        }
+        return set;
+    }
+
+    void start() {
+        team = onPool ? sets.size() : min<int>(omp_get_max_threads(), sets.size());
+        onEachThread(team, [&](int t) { PAPI_start(sets[t]); });
+    }
+
+    void stop() {
+        onEachThread(team, [&](int t) { PAPI_stop(sets[t], values[t].data()); });
+        for (size_t t = team; t < values.size(); t++) fill(values[t].begin(), values[t].end(), 0);
+    }
+
+    // Index of an event in names, or -1 when it is not counted.
+    int find(const string &name) const {
+        for (size_t e = 0; e < names.size(); e++) if (names[e] == name) return e;
+        return -1;
+    }
+
+    // Sum of event e over all threads since the last start().
+    long long total(int e) const {
+        long long sum = 0;
+        if (e < 0) return 0;
+        for (const auto &v : values) sum += v[e];
+        return sum;
+    }
+};
+
+// Counter-based generator: element (i, j) of a matrix is a pure function of the
+// seed, the matrix's stream number and i * cols + j (the splitmix64 finaliser
+// over a Weyl sequence), so rows can be filled in any order by any number of
+// threads and every run with the same seed sees bit-identical inputs.
+inline uint64_t counterRandom(uint64_t seed, uint64_t stream, uint64_t counter) {
+    uint64_t z = seed * 0x9E3779B97F4A7C15ULL + stream * 0xD1B54A32D192ED03ULL + (counter + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Fills a rows x cols block, whose first element is (row0, col0) of a matrix
+// globalCols wide, with integers 1..10, spread across threads by row.
+template <typename T>
+void generateRandomBlock(T *matrix, idx_t rows, idx_t cols, idx_t ld, idx_t row0, idx_t col0, idx_t globalCols,
+                         uint64_t seed, uint64_t stream) {
+  #pragma omp parallel for schedule(static)
+  for (idx_t i = 0; i < rows; i++) {
+      for (idx_t j = 0; j < cols; j++) {
+          uint64_t counter = (uint64_t)((row0 + i) * globalCols + col0 + j);
+          matrix[i * ld + j] = narrow<T>(counterRandom(seed, stream, counter) % 10 + 1);
+      }
+  }
+}
+
+// Fills the rows x cols part of a whole matrix.
+template <typename T>
+void generateRandomMatrix(T *matrix, idx_t rows, idx_t cols, idx_t ld, uint64_t seed, uint64_t stream) {
+  generateRandomBlock(matrix, rows, cols, ld, 0, 0, cols, seed, stream);
+}
+
+// Generator stream that decides which elements of a sparse A are kept, far
+// above the matrix and --verify streams.
+#define DENSITY_STREAM (1ULL << 40)
+
+// Structured inputs for the sparse, symmetric and triangular modes, applied
+// to a generated matrix: structure is general, symmetric (the lower triangle
+// mirrors the upper one) or upper (zeros below the diagonal). Each element of
+// the stored part then survives with probability density, decided by the
+// generator from its (i, j) alone, so modes that read the same --seed,
+// --density and --structure multiply the very same matrix.
+void structureMatrix(double *matrix, idx_t rows, idx_t cols, idx_t ld, const string &structure, double density, uint64_t seed) {
+  const bool symmetric = structure == "symmetric", upper = structure == "upper";
+  const uint64_t keep = density >= 1.0 ? UINT64_MAX : (uint64_t)(density * 0x1.0p64);
+  #pragma omp parallel for schedule(static)
+  for (idx_t i = 0; i < rows; i++) {
+      for (idx_t j = 0; j < cols; j++) {
+          // The symmetric mirror takes the decision of its upper element.
+          idx_t r = symmetric ? min(i, j) : i, c = symmetric ? max(i, j) : j;
+          bool zero = (upper && j < i) || (density < 1.0 && counterRandom(seed, DENSITY_STREAM, (uint64_t)(r * cols + c)) >= keep);
+          if (zero) matrix[i * ld + j] = 0.0;
+          else if (symmetric && j < i) matrix[i * ld + j] = matrix[j * ld + i];
+      }
+  }
+}
+
+// Whether a square matrix already has the structure (for a loaded A, which
+// modes 15 and 16 would otherwise read only half of).
+bool hasStructure(const double *matrix, idx_t rows, idx_t ld, const string &structure) {
+  bool symmetric = structure == "symmetric", ok = true;
+  #pragma omp parallel for schedule(static) reduction(&& : ok)
+  for (idx_t i = 0; i < rows; i++) {
+      for (idx_t j = 0; j < i; j++) {
+          ok = ok && matrix[i * ld + j] == (symmetric ? matrix[j * ld + i] : 0.0);
+      }
+  }
+  return ok;
+}
+
+
+// Theoretical double-precision peak of one core in GFLOPS: clock rate times
+// FLOPs per cycle of the widest FMA unit the CPU has (two FMA pipes assumed).
+// Returns 0 when the clock rate cannot be read; --peak-gflops overrides it.
+double detectPeakGflopsPerCore() {
+    double ghz = 0.0;
+    ifstream maxFreq("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+    double khz;
+    if (maxFreq >> khz) ghz = khz / 1e6;
+    if (ghz == 0.0) {
+        ifstream cpuinfo("/proc/cpuinfo");
+        string line;
+        while (getline(cpuinfo, line)) {
+            if (line.rfind("cpu MHz", 0) == 0) {
+                ghz = max(ghz, atof(line.substr(line.find(':') + 1).c_str()) / 1e3);
+            }
+        }
+    }
+
+    double flopsPerCycle = 4.0;  // SSE2: 2-wide add + 2-wide mul
+#ifdef CPD_X86
+    if (__builtin_cpu_supports("avx512f")) flopsPerCycle = 32.0;
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) flopsPerCycle = 16.0;
+#endif
+    return ghz * flopsPerCycle;
+}
+
+
+// Options accepted as "--name=value" (or a bare "--name") anywhere on the command line.
+const vector<string> knownOptions = {"isa", "hugepages", "warmup", "peak-gflops", "check", "lda", "ldb", "ldc",
+                                   "stream-dir", "panel-m", "panel-k", "cutoff", "task-depth", "autotune", "tune-cache", "order", "dtype", "seed", "verify", "papi-events", "roofline", "dram-event", "results", "morton", "batch", "overlap", "pinned", "device-min", "schedule", "threads", "bind", "smt", "density", "structure",
+                                   "load-a", "load-b", "save-a", "save-b", "save-c", "trace"};
+
+// Splits the command line into positional arguments and options.
+bool parseArguments(int argc, char *argv[], vector<string> &positional, map<string, string> &options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+        size_t eq = arg.find('=');
+        string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+        if (find(knownOptions.begin(), knownOptions.end(), name) == knownOptions.end()) {
+            cerr << "Unknown option: " << arg << endl;
+            return false;
+        }
+        options[name] = (eq == string::npos) ? "1" : arg.substr(eq + 1);
+    }
+    return true;
+}
+
+string getOption(const map<string, string> &options, const string &name, const string &fallback) {
+    auto it = options.find(name);
+    return it == options.end() ? fallback : it->second;
+}
+
+
+// Names accepted in place of the numeric modes.
+const vector<pair<string, int>> namedModes = {{"simple", 1}, {"line", 2}, {"block", 3}, {"packed", 5},
+                                              {"dot", 6}, {"stream", 7}, {"strassen", 8}, {"recursive", 9},
+                                              {"gemm", 10}, {"batched", 11}, {"summa", 12}, {"device", 13},
+                                              {"spmm", 14}, {"symm", 15}, {"trmm", 16}};
+
+// Loop-nest variants run as MODE_VARIANT.
+#define MODE_VARIANT 100
+
+string modeName(int mode, const LoopVariant *variant) {
+    if (variant) return variant->name;
+    for (const auto &m : namedModes) if (m.second == mode) return m.first;
+    return to_string(mode);
+}
+
+// A mode is a number, one of namedModes, or the name of a loopVariants entry.
+bool parseMode(const string &text, int &mode, const LoopVariant *&variant) {
+    variant = nullptr;
+    if (!text.empty() && all_of(text.begin(), text.end(), ::isdigit)) {
+        mode = atoi(text.c_str());
+        return mode >= 1 && mode <= 16 && mode != 4;
+    }
+    for (const auto &m : namedModes) {
+        if (m.first == text) {
+            mode = m.second;
+            return true;
+        }
+    }
+    for (const LoopVariant &v : loopVariants) {
+        if (text == v.name) {
+            mode = MODE_VARIANT;
+            variant = &v;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Roofline: a kernel at arithmetic intensity AI (FLOPs per DRAM byte) cannot
+// beat min(peak, AI * bandwidth). Both ceilings are measured on this machine
+// with the thread count of the run: a STREAM triad for bandwidth and the FMA
+// probe of the selected ISA for compute.
+#define PROBE_REPS 3
+#define PROBE_FMA_ITERS (1 << 24)
+
+// Best STREAM triad rate a[i] = b[i] + s * c[i] in GB/s, counting 24 bytes per
+// element as STREAM does. The arrays are four times the last-level cache.
+double streamTriadGBs(int threads, size_t llcBytes) {
+    size_t n = max<size_t>(4 * llcBytes / sizeof(double), 1 << 22);
+    double *a = allocMatrix(n, false), *b = allocMatrix(n, false), *c = allocMatrix(n, false);
+    if (!a || !b || !c) {
+        freeMatrix(a);
+        freeMatrix(b);
+        freeMatrix(c);
+        return 0.0;
+    }
+    #pragma omp parallel for schedule(static) num_threads(threads)
+    for (size_t i = 0; i < n; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+    double best = 1e300;
+    for (int rep = 0; rep < PROBE_REPS + 1; rep++) {
+        auto start = high_resolution_clock::now();
+        #pragma omp parallel for schedule(static) num_threads(threads)
+        for (size_t i = 0; i < n; i++) a[i] = b[i] + 3.0 * c[i];
+        double t = duration<double>(high_resolution_clock::now() - start).count();
+        if (rep > 0) best = min(best, t);
+    }
+    freeMatrix(a);
+    freeMatrix(b);
+    freeMatrix(c);
+    return 3.0 * sizeof(double) * n / best / 1e9;
+}
+
+// Keeps the probe results live.
+volatile double probeSink;
+
+// Best double-precision FMA rate of threads cores in GFLOPS.
+double probePeakGflops(int threads) {
+    double best = 0.0;
+    for (int rep = 0; rep < PROBE_REPS; rep++) {
+        double flops = 0.0, sink = 0.0;
+        auto start = high_resolution_clock::now();
+        #pragma omp parallel num_threads(threads) reduction(+:flops, sink)
+        {
+            double s;
+            flops += kern.fmaProbe(PROBE_FMA_ITERS, &s);
+            sink += s;
+        }
+        double t = duration<double>(high_resolution_clock::now() - start).count();
+        probeSink = sink;
+        best = max(best, flops / t / 1e9);
+    }
+    return best;
+}
+
+size_t lastLevelCacheBytes() {
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return l3 > 0 ? l3 : l2 > 0 ? l2 : 32 << 20;
+}
+
+// Model of the DRAM traffic of one run when no counter measures it: every
+// matrix is read once while the reused operand fits in the last-level cache;
+// beyond that the unblocked kernels re-read all of B for each row of A, and
+// the blocked ones re-read A once per column tile and B once per row tile.
+double estimateDramBytes(int mode, idx_t M, idx_t N, idx_t K, BlockSizes bk, size_t llcBytes, size_t inBytes, size_t cBytes) {
+    double a = (double)M * K * inBytes, b = (double)K * N * inBytes, c = 2.0 * M * N * cBytes;
+    bool fits = b + (double)K * inBytes + (double)N * cBytes <= llcBytes;
+    if (fits) return a + b + c;
+    if (mode == 1 || mode == 2 || mode == MODE_VARIANT) return a + b * M + c;
+    if (mode == 3) return a * ((N + bk.n - 1) / bk.n) + b * ((M + bk.m - 1) / bk.m) + c;
+    return a + b + c;
+}
+
+
+// Largest element-wise difference between the M x N matrices C and ref, relative
+// to the largest reference entry, for comparing a kernel's output with OnMult.
+template <typename TC>
+double relativeError(idx_t M, idx_t N, const TC *C, idx_t ldc, const double *ref, idx_t ldr) {
+    double maxDiff = 0.0, maxRef = 0.0;
+    for (idx_t i = 0; i < M; i++) {
+        for (idx_t j = 0; j < N; j++) {
+            maxDiff = max(maxDiff, fabs(C[i * ldc + j] - ref[i * ldr + j]));
+            maxRef = max(maxRef, fabs(ref[i * ldr + j]));
+        }
+    }
+    return maxRef > 0 ? maxDiff / maxRef : maxDiff;
+}
+
+// Parses "n" as n for every field, or three fields written as "AxBxC".
+bool parseTriple(const string &text, idx_t &a, idx_t &b, idx_t &c) {
+    long long x, y, z;
+    if (sscanf(text.c_str(), "%lldx%lldx%lld", &x, &y, &z) == 3) {
+        a = x, b = y, c = z;
+        return a > 0 && b > 0 && c > 0;
+    }
+    char *end;
+    long long v = strtoll(text.c_str(), &end, 10);
+    if (*end != '\0' || v <= 0) return false;
+    a = b = c = v;
+    return true;
+}
+
+// Kernels only differ in summation order and FMA contraction.
+#define CHECK_TOLERANCE 1e-10
+
+// Narrow dtypes are compared with the f64 product of the f64 inputs, so their
+// tolerance covers input rounding (2^-24 for f32, 2^-8 for bf16) and float sums.
+double checkTolerance(const string &dtype) {
+    if (dtype == "f32") return 1e-5;
+    if (dtype == "bf16") return 1e-2;
+    return CHECK_TOLERANCE;
+}
+
+// Freivalds' check of C = A * B: for a random r, C r must equal A (B r). A round
+// costs O(MK + KN + MN) instead of the O(MNK) of a reference product, and with
+// r drawn from [-1, 1)^N a wrong C passes it only with negligible probability.
+// Returns the largest |C r - A (B r)| relative to its rounding bound |A| (|B| |r|).
+template <typename TC>
+double freivaldsError(idx_t M, idx_t N, idx_t K, const double *A, idx_t lda, const double *B, idx_t ldb,
+                      const TC *C, idx_t ldc, int rounds, uint64_t seed, uint64_t stream) {
+    vector<double> r(N), br(K), absBr(K);
+    double worst = 0.0;
+    for (int round = 0; round < rounds; round++) {
+        for (idx_t j = 0; j < N; j++) {
+            r[j] = (double)(counterRandom(seed, stream + round, j) >> 11) * 0x1.0p-52 - 1.0;
+        }
+        #pragma omp parallel for schedule(static)
+        for (idx_t k = 0; k < K; k++) {
+            double sum = 0.0, abs = 0.0;
+            for (idx_t j = 0; j < N; j++) {
+                sum += B[k * ldb + j] * r[j];
+                abs += fabs(B[k * ldb + j] * r[j]);
+            }
+            br[k] = sum;
+            absBr[k] = abs;
+        }
+        #pragma omp parallel for schedule(static) reduction(max:worst)
+        for (idx_t i = 0; i < M; i++) {
+            double abr = 0.0, bound = 0.0, cr = 0.0;
+            for (idx_t k = 0; k < K; k++) {
+                abr += A[i * lda + k] * br[k];
+                bound += fabs(A[i * lda + k]) * absBr[k];
+            }
+            for (idx_t j = 0; j < N; j++) cr += C[i * ldc + j] * r[j];
+            double diff = fabs(cr - abr);
+            worst = max(worst, bound > 0 ? diff / bound : diff);
+        }
+    }
+    return worst;
+}
+
+#ifdef CPD_MPI
+// freivaldsError on the SUMMA blocks of every rank, with the same r as the
+// serial check: the partial B r of each block is summed along the process row
+// and the K pieces gathered down the process column, then A (B r) and C r are
+// summed along the process row. Returns the worst row over all ranks.
+double summaFreivaldsError(const SummaGrid &g, const double *A, const double *B, const double *C, int rounds,
+                           uint64_t seed, uint64_t stream) {
+    vector<double> r(g.n), part(2 * g.kb), br(2 * g.K), rows(3 * g.m);
+    vector<int> counts(g.rows), offsets(g.rows);
+    for (int p = 0; p < g.rows; p++) {
+        offsets[p] = 2 * summaOffset(g.K, g.rows, p);
+        counts[p] = 2 * summaOffset(g.K, g.rows, p + 1) - offsets[p];
+    }
+    double worst = 0.0;
+    for (int round = 0; round < rounds; round++) {
+        for (idx_t j = 0; j < g.n; j++) {
+            r[j] = (double)(counterRandom(seed, stream + round, g.n0 + j) >> 11) * 0x1.0p-52 - 1.0;
+        }
+        // part and br interleave B r and |B| |r|.
+        #pragma omp parallel for schedule(static)
+        for (idx_t k = 0; k < g.kb; k++) {
+            double sum = 0.0, abs = 0.0;
+            for (idx_t j = 0; j < g.n; j++) {
+                sum += B[k * g.n + j] * r[j];
+                abs += fabs(B[k * g.n + j] * r[j]);
+            }
+            part[2 * k] = sum;
+            part[2 * k + 1] = abs;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, part.data(), (int)part.size(), MPI_DOUBLE, MPI_SUM, g.row);
+        MPI_Allgatherv(part.data(), (int)part.size(), MPI_DOUBLE, br.data(), counts.data(), offsets.data(), MPI_DOUBLE, g.col);
+
+        #pragma omp parallel for schedule(static)
+        for (idx_t i = 0; i < g.m; i++) {
+            double abr = 0.0, bound = 0.0, cr = 0.0;
+            for (idx_t k = 0; k < g.ka; k++) {
+                abr += A[i * g.ka + k] * br[2 * (g.ka0 + k)];
+                bound += fabs(A[i * g.ka + k]) * br[2 * (g.ka0 + k) + 1];
+            }
+            for (idx_t j = 0; j < g.n; j++) cr += C[i * g.n + j] * r[j];
+            rows[3 * i] = abr;
+            rows[3 * i + 1] = bound;
+            rows[3 * i + 2] = cr;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, rows.data(), (int)rows.size(), MPI_DOUBLE, MPI_SUM, g.row);
+        for (idx_t i = 0; i < g.m; i++) {
+            double diff = fabs(rows[3 * i + 2] - rows[3 * i]), bound = rows[3 * i + 1];
+            worst = max(worst, bound > 0 ? diff / bound : diff);
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &worst, 1, MPI_DOUBLE, MPI_MAX, g.world);
+    return worst;
+}
+#endif
+
+// The f32 and bf16 runs of the simple, line and block kernels; steal is set
+// for the work-stealing schedule.
+template <typename T, typename TC>
+void runTypedKernel(int mode, bool parallel_1, bool parallel_2, BlockSizes bk, const Shape &s, T *A, T *B, TC *C, StealStats *steal) {
+    if (mode == 1) OnMult(s.M, s.N, s.K, A, s.lda, B, s.ldb, C, s.ldc);
+    else if (mode == 2 && steal) OnMultLine_stealing(s.M, s.N, s.K, A, s.lda, B, s.ldb, C, s.ldc, *steal);
+    else if (mode == 3 && steal) OnMultBlock_stealing(s.M, s.N, s.K, bk, A, s.lda, B, s.ldb, C, s.ldc, *steal);
+    else if (mode == 2 && parallel_1) OnMultLine_parallel_1(s.M, s.N, s.K, A, s.lda, B, s.ldb, C, s.ldc);
+    else if (mode == 2 && parallel_2) OnMultLine_parallel_2(s.M, s.N, s.K, A, s.lda, B, s.ldb, C, s.ldc);
+    else if (mode == 2) OnMultLine(s.M, s.N, s.K, A, s.lda, B, s.ldb, C, s.ldc);
+    else if (mode == 3 && parallel_1) OnMultBlock_parallel(s.M, s.N, s.K, bk, A, s.lda, B, s.ldb, C, s.ldc);
+    else if (mode == 3) OnMultBlock(s.M, s.N, s.K, bk, A, s.lda, B, s.ldb, C, s.ldc);
+}
+
+
+// Summary of the timed iterations of one run.
+struct Stats {
+    double min, median, mean, stddev, p95;
+};
+
+Stats computeStats(vector<double> samples) {
+    Stats st = {0, 0, 0, 0, 0};
+    if (samples.empty()) return st;
+    sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    st.min = samples[0];
+    st.median = (n % 2) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    st.mean = accumulate(samples.begin(), samples.end(), 0.0) / n;
+    double sq = 0.0;
+    for (double v : samples) sq += (v - st.mean) * (v - st.mean);
+    st.stddev = n > 1 ? sqrt(sq / (n - 1)) : 0.0;
+    // Nearest-rank percentile.
+    st.p95 = samples[(size_t)ceil(0.95 * n) - 1];
+    return st;
+}
+
+// Output row: one CSV header line and one values line.
+struct CsvRow {
+    vector<string> names, values;
+
+    void add(const string &name, const string &value) {
+        names.push_back(name);
+        values.push_back(value);
+    }
+
+    void add(const string &name, double value, int precision = 6) {
+        ostringstream out;
+        out << setprecision(precision) << value;
+        add(name, out.str());
+    }
+
+    void addStats(const string &name, const Stats &st, int precision = 6) {
+        add(name + "_min", st.min, precision);
+        add(name + "_median", st.median, precision);
+        add(name + "_mean", st.mean, precision);
+        add(name + "_stddev", st.stddev, precision);
+        add(name + "_p95", st.p95, precision);
+    }
+
+    void print(ostream &out) const {
+        for (size_t i = 0; i < names.size(); i++) out << (i ? "," : "") << names[i];
+        out << endl;
+        for (size_t i = 0; i < values.size(); i++) out << (i ? "," : "") << values[i];
+        out << endl;
+    }
+
+    // The same row as one JSON object on one line; values that parse as finite
+    // numbers are written as numbers, everything else as strings.
+    void printJson(ostream &out) const {
+        out << "{";
+        for (size_t i = 0; i < names.size(); i++) {
+            out << (i ? ", " : "") << jsonString(names[i]) << ": ";
+            char *end = nullptr;
+            double v = strtod(values[i].c_str(), &end);
+            bool number = !values[i].empty() && *end == '\0' && isfinite(v);
+            out << (number ? values[i] : jsonString(values[i]));
+        }
+        out << "}" << endl;
+    }
+
+    static string jsonString(const string &text) {
+        string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            if ((unsigned char)c < 0x20) {
+                char hex[8];
+                snprintf(hex, sizeof(hex), "\\u%04x", c);
+                out += hex;
+                continue;
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+};
+
+// Compiler flags are only known to the build; script.sh passes them with -DCPD_BUILD_FLAGS.
+#ifndef CPD_BUILD_FLAGS
+#define CPD_BUILD_FLAGS "unknown"
+#endif
+#if defined(__GNUC__) && !defined(__clang__)
+#define CPD_COMPILER "gcc " __VERSION__
+#else
+#define CPD_COMPILER __VERSION__
+#endif
+
+string hostName() {
+    char name[256] = {0};
+    if (gethostname(name, sizeof(name) - 1) != 0) return "unknown";
+    return name;
+}
+
+// Current UTC time as ISO 8601.
+string timestampUtc() {
+    time_t now = time(nullptr);
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    return text;
+}
+
+
+// Autotuning of the blocked kernel (mode 3). Candidates are scored by wall time;
+// those within TUNE_NOISE of each other are ranked by their L2 + L3 misses, which
+// are steadier than the clock. Winners are kept in a plain-text cache, one line
+// per CPU model, ISA, shape and parallel flag.
+#define TUNE_REPS 2
+#define TUNE_NOISE 0.02
+
+struct TuneResult {
+    BlockSizes bk;
+    int threads;
+    double time;
+    long long misses[3];
+};
+
+const char *tileOrderName(TileOrder order) {
+    return order == TILE_IKJ ? "ikj" : "ijk";
+}
+
+bool parseTileOrder(const string &text, TileOrder &order) {
+    if (text == "ijk") order = TILE_IJK;
+    else if (text == "ikj") order = TILE_IKJ;
+    else return false;
+    return true;
+}
+
+// "model name" of the first CPU in /proc/cpuinfo, with blanks replaced so it fits in one token.
+string cpuModel() {
+    ifstream cpuinfo("/proc/cpuinfo");
+    string line;
+    while (getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) != 0) continue;
+        string model = line.substr(line.find(':') + 2);
+        replace(model.begin(), model.end(), ' ', '_');
+        return model;
+    }
+    return "unknown";
+}
+
+// Thread placement. The topology comes from /sys/devices/system/cpu: for every
+// CPU the process may run on, its package, core, position among its SMT
+// siblings and the first CPU of the L2 and L3 caches it shares (the cache's id).
+struct CpuPlace {
+    int cpu, package, core, sibling, l2, l3;
+};
+
+string readSysFile(const string &path) {
+    ifstream in(path);
+    string text;
+    getline(in, text);
+    return text;
+}
+
+// CPU numbers of a list such as "0-3,8-11".
+vector<int> parseCpuList(const string &text) {
+    vector<int> cpus;
+    istringstream in(text);
+    for (string part; getline(in, part, ',');) {
+        int first, last;
+        int fields = sscanf(part.c_str(), "%d-%d", &first, &last);
+        if (fields < 1) continue;
+        if (fields == 1) last = first;
+        for (int c = first; c <= last; c++) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+vector<CpuPlace> readTopology() {
+    vector<CpuPlace> cpus;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        string dir = "/sys/devices/system/cpu/cpu" + to_string(cpu);
+        CpuPlace p = {cpu, atoi(readSysFile(dir + "/topology/physical_package_id").c_str()),
+                      atoi(readSysFile(dir + "/topology/core_id").c_str()), 0, cpu, cpu};
+        vector<int> siblings = parseCpuList(readSysFile(dir + "/topology/thread_siblings_list"));
+        p.sibling = count_if(siblings.begin(), siblings.end(), [&](int c) { return c < cpu; });
+        for (int index = 0; index < 8; index++) {
+            string cache = dir + "/cache/index" + to_string(index);
+            string level = readSysFile(cache + "/level");
+            if (level.empty()) break;
+            vector<int> shared = parseCpuList(readSysFile(cache + "/shared_cpu_list"));
+            if (shared.empty()) continue;
+            if (level == "2") p.l2 = shared[0];
+            if (level == "3") p.l3 = shared[0];
+        }
+        cpus.push_back(p);
+    }
+    return cpus;
+}
+
+// Topological order: neighbours share a package, then an L3, an L2 and a core.
+bool topologicalLess(const CpuPlace &a, const CpuPlace &b) {
+    return tie(a.package, a.l3, a.l2, a.core, a.sibling) < tie(b.package, b.l3, b.l2, b.core, b.sibling);
+}
+
+// The CPUs of threads threads under bind: compact fills the SMT siblings of a
+// core before the next core, cores takes one thread per core before any
+// second sibling, spread deals threads round-robin over the L3 caches. Without
+// smt only the first sibling of each core is used. The chosen CPUs are then
+// numbered in topological order, so the contiguous tile ranges that static
+// schedules hand to threads t and t + 1 run on CPUs sharing an L2 or L3.
+vector<int> choosePlaces(vector<CpuPlace> cpus, const string &bind, bool smt, int threads) {
+    if (!smt) cpus.erase(remove_if(cpus.begin(), cpus.end(), [](const CpuPlace &p) { return p.sibling > 0; }), cpus.end());
+    sort(cpus.begin(), cpus.end(), topologicalLess);
+    if (bind == "cores") {
+        stable_sort(cpus.begin(), cpus.end(), [](const CpuPlace &a, const CpuPlace &b) { return a.sibling < b.sibling; });
+    } else if (bind == "spread") {
+        // Rank of each CPU among the first siblings (or second, ...) of its L3.
+        map<pair<int, int>, int> seen;
+        vector<int> rank(cpus.size());
+        for (size_t i = 0; i < cpus.size(); i++) rank[i] = seen[{cpus[i].l3, cpus[i].sibling}]++;
+        vector<size_t> order(cpus.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return tie(cpus[a].sibling, rank[a]) < tie(cpus[b].sibling, rank[b]);
+        });
+        vector<CpuPlace> dealt;
+        for (size_t i : order) dealt.push_back(cpus[i]);
+        cpus = dealt;
+    }
+    vector<CpuPlace> chosen;
+    for (int t = 0; t < threads && !cpus.empty(); t++) chosen.push_back(cpus[t % cpus.size()]);
+    stable_sort(chosen.begin(), chosen.end(), topologicalLess);
+    vector<int> places;
+    for (const CpuPlace &p : chosen) places.push_back(p.cpu);
+    return places;
+}
+
+bool pinCurrentThread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// e.g. "1p4c2t1l3": packages, cores, SMT siblings per core and L3 caches.
+string topologySummary(const vector<CpuPlace> &cpus) {
+    set<pair<int, int>> cores;
+    set<int> packages, l3s;
+    int siblings = 0;
+    for (const CpuPlace &p : cpus) {
+        packages.insert(p.package);
+        cores.insert({p.package, p.core});
+        l3s.insert(p.l3);
+        siblings = max(siblings, p.sibling + 1);
+    }
+    return to_string(packages.size()) + "p" + to_string(cores.size()) + "c" + to_string(siblings) + "t" + to_string(l3s.size()) + "l3";
+}
+
+// maxThreads is the thread budget of the run; a tuning never uses more threads than it was tuned with.
+string tuneKey(idx_t M, idx_t N, idx_t K, bool parallel, int maxThreads) {
+    return "cpu=" + cpuModel() + " isa=" + kern.isa + " shape=" + to_string(M) + "x" + to_string(K) + "x" +
+           to_string(N) + " parallel=" + (parallel ? "1" : "0") + " max_threads=" + to_string(maxThreads);
+}
+
+string formatTuning(const string &key, const TuneResult &r) {
+    ostringstream out;
+    out << key << " block=" << r.bk.m << "x" << r.bk.k << "x" << r.bk.n << " order=" << tileOrderName(r.bk.order)
+        << " threads=" << r.threads << " time=" << r.time;
+    for (int e = 0; e < 3; e++) out << " " << eventColumns[e].second << "=" << r.misses[e];
+    return out.str();
+}
+
+bool loadTuning(const string &path, const string &key, TuneResult &r) {
+    ifstream in(path);
+    string line;
+    while (getline(in, line)) {
+        if (line.rfind(key + " ", 0) != 0) continue;
+        istringstream fields(line.substr(key.size()));
+        string field;
+        bool ok = true;
+        while (ok && fields >> field) {
+            size_t eq = field.find('=');
+            string name = field.substr(0, eq), value = eq == string::npos ? "" : field.substr(eq + 1);
+            if (name == "block") ok = parseTriple(value, r.bk.m, r.bk.k, r.bk.n);
+            else if (name == "order") ok = parseTileOrder(value, r.bk.order);
+            else if (name == "threads") r.threads = atoi(value.c_str());
+            else if (name == "time") r.time = atof(value.c_str());
+        }
+        if (ok && r.threads > 0) return true;
+    }
+    return false;
+}
+
+// Rewrites the cache with this key's line replaced (or appended).
+bool saveTuning(const string &path, const string &key, const TuneResult &r) {
+    vector<string> lines;
+    ifstream in(path);
+    string line;
+    while (getline(in, line)) {
+        if (line.rfind(key + " ", 0) != 0) lines.push_back(line);
+    }
+    in.close();
+    lines.push_back(formatTuning(key, r));
+    ofstream out(path, ios::trunc);
+    for (const string &l : lines) out << l << "\n";
+    return (bool)out;
+}
+
+// Candidate values of one tile dimension, clipped to the dimension and deduplicated.
+vector<idx_t> tileCandidates(const vector<idx_t> &sizes, idx_t dim) {
+    vector<idx_t> out;
+    for (idx_t s : sizes) {
+        idx_t v = min(s, dim);
+        if (find(out.begin(), out.end(), v) == out.end()) out.push_back(v);
+    }
+    return out;
+}
+
+bool betterTuning(const TuneResult &a, const TuneResult &b) {
+    if (a.time < b.time * (1.0 - TUNE_NOISE)) return true;
+    if (b.time < a.time * (1.0 - TUNE_NOISE)) return false;
+    return a.misses[1] + a.misses[2] < b.misses[1] + b.misses[2];
+}
+
+// Coordinate search from a 128x256x256 ijk start: each sweep tries every value
+// of one parameter with the others fixed and keeps the best, until a full
+// sweep changes nothing. Thread counts are only searched for the parallel kernel,
+// and not when fixedThreads (an explicit --threads) holds them.
+TuneResult autotuneBlock(idx_t M, idx_t N, idx_t K, double *pha, idx_t lda, double *phb, idx_t ldb, double *phc, idx_t ldc,
+                         bool parallel, bool fixedThreads, ThreadCounters &papi) {
+    int maxThreads = omp_get_max_threads();
+    vector<int> threadCandidates;
+    for (int t = 1; t < maxThreads; t *= 2) if (parallel && !fixedThreads) threadCandidates.push_back(t);
+    threadCandidates.push_back(parallel ? maxThreads : 1);
+
+    auto evaluate = [&](TuneResult &r) {
+        omp_set_num_threads(r.threads);
+        r.time = 1e300;
+        for (int rep = 0; rep < TUNE_REPS; rep++) {
+            papi.start();
+            auto start = high_resolution_clock::now();
+            zeroMatrix(M, N, phc, ldc);
+            blockAccumulate(M, N, K, r.bk, pha, lda, phb, ldb, phc, ldc, parallel);
+            double t = duration<double>(high_resolution_clock::now() - start).count();
+            papi.stop();
+            if (t < r.time) {
+                r.time = t;
+                for (int e = 0; e < 3; e++) r.misses[e] = papi.total(papi.find(eventColumns[e].first));
+            }
+        }
+        cerr << "autotune: block=" << r.bk.m << "x" << r.bk.k << "x" << r.bk.n << " order=" << tileOrderName(r.bk.order)
+             << " threads=" << r.threads << " time=" << r.time << endl;
+    };
+
+    TuneResult best = {{min<idx_t>(128, M), min<idx_t>(256, N), min<idx_t>(256, K), TILE_IJK}, maxThreads, 0, {0, 0, 0}};
+    if (!parallel) best.threads = 1;
+    evaluate(best);
+
+    vector<idx_t> mSizes = tileCandidates({32, 64, 128, 256, 512}, M);
+    vector<idx_t> nSizes = tileCandidates({64, 256, 1024, N}, N);
+    vector<idx_t> kSizes = tileCandidates({64, 128, 256, 512}, K);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        auto tryCandidate = [&](const TuneResult &c) {
+            if (c.bk.m == best.bk.m && c.bk.n == best.bk.n && c.bk.k == best.bk.k &&
+                c.bk.order == best.bk.order && c.threads == best.threads) return;
+            TuneResult r = c;
+            evaluate(r);
+            if (betterTuning(r, best)) {
+                best = r;
+                changed = true;
+            }
+        };
+        for (idx_t v : mSizes) { TuneResult c = best; c.bk.m = v; tryCandidate(c); }
+        for (idx_t v : nSizes) { TuneResult c = best; c.bk.n = v; tryCandidate(c); }
+        for (idx_t v : kSizes) { TuneResult c = best; c.bk.k = v; tryCandidate(c); }
+        for (TileOrder o : {TILE_IJK, TILE_IKJ}) { TuneResult c = best; c.bk.order = o; tryCandidate(c); }
+        for (int t : threadCandidates) { TuneResult c = best; c.threads = t; tryCandidate(c); }
+    }
+    omp_set_num_threads(best.threads);
+    return best;
+}
+
+
+int main(int argc, char *argv[]) {
+  // In the MPI build every rank runs main; only rank 0 prints the row. The
+  // helper thread of mode 12 makes the broadcasts while the main thread computes.
+  int mpiRank = 0;
+#ifdef CPD_MPI
+  int mpiThreads = MPI_THREAD_SINGLE;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &mpiThreads);
+  atexit([] { MPI_Finalize(); });
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpiRank);
+#endif
+  vector<string> args;
+  map<string, string> options;
+  if (!parseArguments(argc, argv, args, options) || args.size() < 4) {
+      cerr << "Usage: ./multiplication <mode> <size|MxKxN> <iterations> <parallel_flag> [block_size|MBxKBxNB] [--warmup=N] [--isa=auto|scalar|avx2|avx512] [--hugepages] [--peak-gflops=per_core] [--check] [--lda=N] [--ldb=N] [--ldc=N] [--dtype=f64|f32|bf16] [--seed=N] [--verify[=ROUNDS]]" << endl;
+      cerr << "       [--papi-events=EVENT,...] (default " << DEFAULT_EVENTS << ") [--dram-event=EVENT[*BYTES]] [--roofline=0]" << endl;
+      cerr << "       [--results=FILE] (append the row, with run metadata, as one JSON line)" << endl;
+      cerr << "       [--load-a=FILE] [--load-b=FILE] (size - takes the shape from them) [--save-a=FILE] [--save-b=FILE] [--save-c=FILE]" << endl;
+      cerr << "       [--trace=FILE] (Chrome trace JSON of the timed iterations; builds with -DCPD_TRACE)" << endl;
+      cerr << "       [--threads=N] [--bind=compact|spread|cores [--smt=0]] (pin thread i to one CPU, reported in Places)" << endl;
+      cerr << "       mode 7: [--stream-dir=DIR] [--panel-m=ROWS] [--panel-k=ROWS]" << endl;
+      cerr << "       mode 3: [--order=ijk|ikj] [--autotune[=force]] [--tune-cache=FILE] (block_size may be omitted once tuned)" << endl;
+      cerr << "       mode 9: [--morton]" << endl;
+      cerr << "       modes 2 and 3 (parallel): [--schedule=static|steal]" << endl;
+      cerr << "       [--density=FRACTION] [--structure=general|symmetric|upper] (nonzeros and shape of A; modes 14-16 and the dense modes)" << endl;
+      cerr << "       mode 11: [--batch=COUNT] (default: 64 MB of problems)" << endl;
+      cerr << "       mode 8: [--cutoff=N] [--task-depth=LEVELS] [--check=0]" << endl;
+      cerr << "       mode 12: [--panel-k=WIDTH] [--overlap=0] (MPI build, under mpirun)" << endl;
+      cerr << "       modes 10 and 13: [--pinned] [--device-min=MULTIPLY_ADDS] (mode 10 offloads products from this size)" << endl;
+      cerr << "Modes: 1 simple, 2 line, 3 block, 5 packed, 6 dot product on transposed B, 7 out-of-core streaming, 8 Strassen-Winograd, 9 cache-oblivious recursive," << endl;
+      cerr << "       10 library gemm() on its persistent worker pool, 11 batched small problems (size is one problem)," << endl;
+      cerr << "       12 SUMMA over a 2D grid of MPI ranks, 13 tiled kernel on the OpenMP offload device," << endl;
+      cerr << "       14 CSR sparse A times dense B, 15 symmetric A (upper triangle read), 16 upper triangular A" << endl;
+      cerr << "       or a loop variant: ijk, ikj, jik, jki, kij, kji, optionally prefixed with blocked-" << endl;
+      return 1;
+  }
+
+  int mode;
+  const LoopVariant *variant = nullptr;
+  if (!parseMode(args[0], mode, variant)) {
+      cerr << "Unknown mode '" << args[0] << "'. Modes: 1-3 and 5-16 or their names (";
+      for (size_t m = 0; m < namedModes.size(); m++) cerr << (m ? " " : "") << namedModes[m].first;
+      cerr << "), or a loop variant (";
+      for (size_t v = 0; v < loopVariants.size(); v++) cerr << (v ? " " : "") << loopVariants[v].name;
+      cerr << ")." << endl;
+      return 1;
+  }
+  // --trace=FILE records the spans of the timed iterations (builds with -DCPD_TRACE).
+  string tracePath = getOption(options, "trace", "");
+#ifndef CPD_TRACE
+  if (!tracePath.empty()) {
+      cerr << "--trace needs a build with -DCPD_TRACE (TRACE=1 ./script.sh)." << endl;
+      return 1;
+  }
+#endif
+  if (!tracePath.empty() && mpiRank > 0) tracePath += "." + to_string(mpiRank);
+
+  // --load-a and --load-b map matrix files in place of the generated inputs,
+  // outside the timed loop (Load_time); the --save-* options write matrices in
+  // the same format after it (Save_time).
+  string loadA = getOption(options, "load-a", ""), loadB = getOption(options, "load-b", "");
+  MatrixFile fileA = {}, fileB = {};
+  double load_time = 0.0, save_time = 0.0;
+  bool fileIO = !loadA.empty() || !loadB.empty() || options.count("save-a") || options.count("save-b") || options.count("save-c");
+  if (fileIO && (mode == 7 || mode == 11 || mode == 12)) {
+      if (mpiRank == 0) cerr << "Matrix files do not apply to modes 7, 11 and 12." << endl;
+      return 1;
+  }
+  if (!loadA.empty() && (options.count("lda") || options.count("density") || options.count("structure") || options.count("pinned"))) {
+      cerr << "A loaded A is used as it is: no --lda, --density, --structure or --pinned." << endl;
+      return 1;
+  }
+  if (!loadB.empty() && (options.count("ldb") || options.count("pinned"))) {
+      cerr << "A loaded B is used as it is: no --ldb or --pinned." << endl;
+      return 1;
+  }
+  {
+      auto start = high_resolution_clock::now();
+      if (!loadA.empty() && !loadMatrixFile(loadA, fileA)) return 1;
+      if (!loadB.empty() && !loadMatrixFile(loadB, fileB)) return 1;
+      load_time = duration<double>(high_resolution_clock::now() - start).count();
+  }
+
+  // A square size n stands for n x n x n.
+  Shape shape;
+  if (args[1] == "-" && !loadA.empty() && !loadB.empty()) {
+      shape.M = fileA.header.rows;
+      shape.K = fileA.header.cols;
+      shape.N = fileB.header.cols;
+  } else if (!parseTriple(args[1], shape.M, shape.K, shape.N)) {
+      cerr << "Invalid size '" << args[1] << "' (expected n, MxKxN, or - with --load-a and --load-b)." << endl;
+      return 1;
+  }
+  if ((!loadA.empty() && ((idx_t)fileA.header.rows != shape.M || (idx_t)fileA.header.cols != shape.K)) ||
+      (!loadB.empty() && ((idx_t)fileB.header.rows != shape.K || (idx_t)fileB.header.cols != shape.N))) {
+      cerr << "The loaded matrices do not match the size " << shape.M << "x" << shape.K << "x" << shape.N << "." << endl;
+      return 1;
+  }
+  shape.lda = loadA.empty() ? atoll(getOption(options, "lda", to_string(shape.K)).c_str()) : fileA.header.ld;
+  shape.ldb = loadB.empty() ? atoll(getOption(options, "ldb", to_string(shape.N)).c_str()) : fileB.header.ld;
+  shape.ldc = atoll(getOption(options, "ldc", to_string(shape.N)).c_str());
+  if (shape.lda < shape.K || shape.ldb < shape.N || shape.ldc < shape.N) {
+      cerr << "Leading dimensions must be at least the row length (lda >= K, ldb >= N, ldc >= N)." << endl;
+      return 1;
+  }
+  const idx_t M = shape.M, N = shape.N, K = shape.K;
+  // Timed iterations run back to back on the same buffers, after the untimed warmup ones.
+  int iterations = atoi(args[2].c_str());
+  int warmup = atoi(getOption(options, "warmup", "0").c_str());
+  bool parallel_1 = (atoi(args[3].c_str()) == 1);
+  bool parallel_2 = (atoi(args[3].c_str()) == 2);
+  // One block size applies to all three loops; MBxKBxNB tunes them separately.
+  BlockSizes bk = {-1, -1, -1, TILE_IJK};
+  bool hasBlock = args.size() == 5 && parseTriple(args[4], bk.m, bk.k, bk.n);
+
+  if (!selectKernels(getOption(options, "isa", "auto"))) return 1;
+
+  // --threads sizes the OpenMP team and the gemm() pool (over a cached tuning
+  // too); --bind below pins thread t to places[t], before any page is first touched.
+  if (options.count("threads")) {
+      int n = atoi(options["threads"].c_str());
+      if (n < 1) {
+          cerr << "--threads must be positive." << endl;
+          return 1;
+      }
+      omp_set_num_threads(n);
+  }
+  if (iterations < 1 || warmup < 0) {
+      cerr << "The number of iterations must be positive and --warmup non-negative." << endl;
+      return 1;
+  }
+
+  // Narrow element types run the simple, line and block kernels only.
+  string dtype = getOption(options, "dtype", "f64");
+  if (dtype != "f64" && dtype != "f32" && dtype != "bf16") {
+      cerr << "Unknown dtype '" << dtype << "' (expected f64, f32 or bf16)." << endl;
+      return 1;
+  }
+  if (dtype != "f64" && mode != 1 && mode != 2 && mode != 3) {
+      cerr << "--dtype=" << dtype << " is supported by modes 1, 2 and 3 only." << endl;
+      return 1;
+  }
+  if (dtype != "f64" && options.count("autotune")) {
+      cerr << "--autotune tunes the f64 kernel only." << endl;
+      return 1;
+  }
+
+  if (options.count("order") && !parseTileOrder(options["order"], bk.order)) {
+      cerr << "Invalid --order '" << options["order"] << "' (expected ijk or ikj)." << endl;
+      return 1;
+  }
+
+  // Mode 3 without a block size takes the cached tuning for this machine and
+  // shape; --autotune searches when there is none (or always with =force).
+  string tuneCache = getOption(options, "tune-cache", "tuning.cache");
+  string tuneKeyText = tuneKey(M, N, K, parallel_1, omp_get_max_threads());
+  string autotune = getOption(options, "autotune", "0");
+  string tuning = "-";
+  bool runAutotune = false;
+  if (autotune != "0" && mode != 3) {
+      cerr << "--autotune applies to mode 3 only." << endl;
+      return 1;
+  }
+  if (mode == 3 && !hasBlock) {
+      TuneResult cached;
+      if (autotune != "force" && loadTuning(tuneCache, tuneKeyText, cached)) {
+          bk = cached.bk;
+          hasBlock = true;
+          if (!options.count("threads")) omp_set_num_threads(cached.threads);
+          tuning = "cache";
+      } else if (autotune != "0") {
+          bk = {128, 256, 256, TILE_IJK};
+          runAutotune = true;
+      } else {
+          cerr << "Mode 3 requires a positive block_size (n or MBxKBxNB), a tuning in " << tuneCache << " or --autotune." << endl;
+          return 1;
+      }
+  }
+
+  // Pinning follows the tuning, which may change the thread count.
+  string bind = getOption(options, "bind", "none");
+  bool smt = getOption(options, "smt", "1") != "0";
+  if (bind != "none" && bind != "compact" && bind != "spread" && bind != "cores") {
+      cerr << "Unknown binding '" << bind << "' (expected compact, spread or cores)." << endl;
+      return 1;
+  }
+  if (options.count("smt") && bind == "none") {
+      cerr << "--smt selects the CPUs of --bind." << endl;
+      return 1;
+  }
+  vector<CpuPlace> topology = readTopology();
+  vector<int> places;
+  if (bind != "none") {
+      places = choosePlaces(topology, bind, smt, omp_get_max_threads());
+      if (places.empty()) {
+          cerr << "Cannot read the CPU topology for --bind." << endl;
+          return 1;
+      }
+      if (set<int>(places.begin(), places.end()).size() < places.size()) {
+          cerr << "Warning: more threads than CPUs for --bind=" << bind << ", some CPUs run two threads." << endl;
+      }
+      bool pinned_all = true;
+      #pragma omp parallel reduction(&&:pinned_all)
+      pinned_all = pinCurrentThread(places[omp_get_thread_num() % places.size()]);
+      if (!pinned_all) cerr << "Warning: sched_setaffinity failed, threads are not all bound." << endl;
+  }
+  string bindName = bind;
+  if (bind == "none" && getenv("OMP_PROC_BIND")) bindName = string("omp:") + getenv("OMP_PROC_BIND");
+  string placesText;
+  for (int cpu : places) placesText += (placesText.empty() ? "" : " ") + to_string(cpu);
+
+  // Mode 7 streams tightly packed files, so the leading dimensions are the row lengths.
+  idx_t panelM = atoll(getOption(options, "panel-m", "2048").c_str());
+  idx_t panelK = atoll(getOption(options, "panel-k", "512").c_str());
+  if (mode == 7) {
+      if (options.count("lda") || options.count("ldb") || options.count("ldc") || panelM <= 0 || panelK <= 0) {
+          cerr << "Mode 7 takes no leading dimensions and needs positive --panel-m/--panel-k." << endl;
+          return 1;
+      }
+      if (!hasBlock) bk = {256, 256, 256, TILE_IJK};
+  }
+
+  // A can be made sparse (--density) and symmetric or upper triangular
+  // (--structure), which modes 14-16 exploit; the dense modes multiply the same
+  // matrix as it is, for the crossover against them.
+  double density = atof(getOption(options, "density", "1").c_str());
+  string structure = getOption(options, "structure", mode == 15 ? "symmetric" : mode == 16 ? "upper" : "general");
+  if (density <= 0.0 || density > 1.0 || (structure != "general" && structure != "symmetric" && structure != "upper")) {
+      cerr << "--density must be in (0, 1] and --structure general, symmetric or upper." << endl;
+      return 1;
+  }
+  bool structured = density < 1.0 || structure != "general";
+  if (structured && (mode == 7 || mode == 11 || mode == 12)) {
+      if (mpiRank == 0) cerr << "--density and --structure do not apply to modes 7, 11 and 12." << endl;
+      return 1;
+  }
+  if (structure != "general" && M != K) {
+      cerr << "A symmetric or triangular A must be square (M = K)." << endl;
+      return 1;
+  }
+  if ((mode == 15 && structure != "symmetric") || (mode == 16 && structure != "upper")) {
+      cerr << "Mode " << mode << " needs --structure=" << (mode == 15 ? "symmetric" : "upper") << "." << endl;
+      return 1;
+  }
+  if ((mode == 15 || mode == 16) && !hasBlock) bk = {128, 256, 256, TILE_IJK};
+
+  // Mode 8 recurses down to the cutoff and runs the blocked kernel there; tasks
+  // are spawned for the seven products of the top --task-depth levels.
+  StrassenConfig strassen = {atoll(getOption(options, "cutoff", "512").c_str()),
+                             atoi(getOption(options, "task-depth", parallel_1 ? "2" : "0").c_str()),
+                             hasBlock ? bk : BlockSizes{128, 256, 256, bk.order}};
+  if (mode == 8 && strassen.cutoff < 1) {
+      cerr << "Mode 8 requires a positive --cutoff." << endl;
+      return 1;
+  }
+
+  // Mode 12 splits the matrices over a 2D grid of MPI ranks, in tightly packed
+  // blocks, and multiplies them in --panel-k wide SUMMA panels.
+#ifdef CPD_MPI
+  SummaGrid grid;
+#endif
+  bool overlap = getOption(options, "overlap", "1") != "0";
+  if (mode == 12) {
+#ifdef CPD_MPI
+      if (options.count("lda") || options.count("ldb") || options.count("ldc") || options.count("check") || panelK <= 0) {
+          if (mpiRank == 0) cerr << "Mode 12 takes no leading dimensions or --check (use --verify) and needs a positive --panel-k." << endl;
+          return 1;
+      }
+      if (!createSummaGrid(MPI_COMM_WORLD, M, N, K, grid)) return 1;
+      if (overlap && mpiThreads < MPI_THREAD_SERIALIZED) {
+          if (mpiRank == 0) cerr << "Warning: the MPI library is not thread-safe enough to overlap the broadcasts, running with --overlap=0." << endl;
+          overlap = false;
+      }
+#else
+      cerr << "Mode 12 needs the MPI build (mpicxx -DCPD_MPI, MPI=1 ./script.sh), run under mpirun." << endl;
+      return 1;
+#endif
+  }
+
+  // --schedule=steal runs the parallel line and block kernels on the
+  // work-stealing tile scheduler instead of a static split.
+  string schedule = getOption(options, "schedule", "static");
+  if (schedule != "static" && schedule != "steal") {
+      cerr << "Unknown schedule '" << schedule << "' (expected static or steal)." << endl;
+      return 1;
+  }
+  bool steal = schedule == "steal";
+  if (steal && !((mode == 2 && (parallel_1 || parallel_2)) || (mode == 3 && parallel_1))) {
+      cerr << "--schedule=steal applies to the parallel modes 2 and 3." << endl;
+      return 1;
+  }
+
+  // Mode 13 always runs on the device and mode 10 when gemm() routes the
+  // product there. --pinned page-locks A, B and C for faster transfers.
+  bool pinned = options.count("pinned") > 0;
+  if (pinned && (mode == 7 || options.count("hugepages"))) {
+      cerr << "--pinned does not combine with mode 7 or --hugepages." << endl;
+      return 1;
+  }
+  if (options.count("device-min")) gemmSetDeviceThreshold(atof(options["device-min"].c_str()));
+  string device = "-";
+  if (mode == 13) device = deviceAvailable() ? "device" + to_string(omp_get_default_device()) : "host-fallback";
+  else if (mode == 10) device = gemmUsesDevice(M, N, K) ? "device" + to_string(omp_get_default_device()) : "host";
+
+  // Initialize PAPI
+  initPAPI();
+
+  // First-touch pages with the row chunking of the kernel that will run on them.
+  idx_t rowsPerChunk = 1;
+  if (mode == 3 || mode == 15 || mode == 16) rowsPerChunk = bk.m;
+  else if (mode == 6) rowsPerChunk = DOT_TILE;
+  else if (mode == 5 || mode == 10 || mode == 12) rowsPerChunk = GEMM_MC;
+  else if (mode == 9) rowsPerChunk = REC_TILE;
+
+  // Mode 11 stacks its batch of problems: problem b is rows b*M.. of A and C and
+  // rows b*K.. of B, so one allocation and one generator call cover all of them.
+  idx_t batch = 1;
+  if (mode == 11) {
+      idx_t words = M * shape.lda + K * shape.ldb + M * shape.ldc;
+      batch = atoll(getOption(options, "batch", to_string(max<idx_t>(1, (64 << 20) / sizeof(double) / words))).c_str());
+      if (batch < 1) {
+          cerr << "--batch must be positive." << endl;
+          return 1;
+      }
+  }
+  Shape storage = shape;
+  storage.M *= batch;
+  storage.K *= batch;
+#ifdef CPD_MPI
+  // A rank holds its m x ka block of A, kb x n block of B and m x n block of C.
+  if (mode == 12) storage = {grid.m, grid.n, grid.kb, grid.ka, grid.n, grid.n};
+#endif
+
+  // A and B are streams 0 and 1 of the counter-based generator.
+  uint64_t seed = strtoull(getOption(options, "seed", "1").c_str(), nullptr, 10);
+  double *A, *B, *C;
+  MappedMatrix mapA, mapB, mapC;
+  if (mode == 7) {
+      // Inputs persist in the stream directory; their headers record the shape
+      // and seed, and they are generated again when either differs.
+      string dir = getOption(options, "stream-dir", ".");
+      bool newA, newB, newC;
+      if (!mapMatrixFile(dir + "/A.bin", M, K, seed, false, mapA, newA) ||
+          !mapMatrixFile(dir + "/B.bin", K, N, seed, false, mapB, newB) ||
+          !mapMatrixFile(dir + "/C.bin", M, N, MATRIX_SEED_NONE, true, mapC, newC)) return 1;
+      A = mapA.data;
+      B = mapB.data;
+      C = mapC.data;
+      if (newA) generateRandomMatrix(A, M, K, K, seed, 0);
+      if (newB) generateRandomMatrix(B, K, N, N, seed, 1);
+  } else if (!loadA.empty() || !loadB.empty()) {
+      // Loaded operands are used from their mappings; the others are allocated and generated.
+      bool hugePages = options.count("hugepages") > 0;
+      A = loadA.empty() ? allocMatrix((size_t)M * shape.lda, hugePages) : fileA.data;
+      B = loadB.empty() ? allocMatrix((size_t)K * shape.ldb, hugePages) : fileB.data;
+      C = allocMatrix((size_t)M * shape.ldc, hugePages);
+      if (!A || !B || !C) {
+          cerr << "Error allocating matrices!" << endl;
+          return 1;
+      }
+      if (loadA.empty()) {
+          firstTouch(A, M, shape.lda, rowsPerChunk);
+          generateRandomMatrix(A, M, K, shape.lda, seed, 0);
+      }
+      if (loadB.empty()) {
+          firstTouch(B, K, shape.ldb, rowsPerChunk);
+          generateRandomMatrix(B, K, N, shape.ldb, seed, 1);
+      }
+      firstTouch(C, M, shape.ldc, rowsPerChunk);
+  } else {
+      if (pinned) {
+          A = allocPinned((size_t)storage.M * storage.lda);
+          B = allocPinned((size_t)storage.K * storage.ldb);
+          C = allocPinned((size_t)storage.M * storage.ldc);
+          if (!A || !B || !C) {
+              cerr << "Error allocating pinned matrices!" << endl;
+              return 1;
+          }
+          firstTouch(A, storage.M, storage.lda, rowsPerChunk);
+          firstTouch(B, storage.K, storage.ldb, rowsPerChunk);
+          firstTouch(C, storage.M, storage.ldc, rowsPerChunk);
+      } else if (!matrixMemoryAllocation(A, B, C, storage, options.count("hugepages") > 0, rowsPerChunk)) return 1;
+#ifdef CPD_MPI
+      if (mode == 12) {
+          // Each rank generates its blocks of the same global A and B.
+          generateRandomBlock(A, grid.m, grid.ka, grid.ka, grid.m0, grid.ka0, K, seed, 0);
+          generateRandomBlock(B, grid.kb, grid.n, grid.n, grid.kb0, grid.n0, N, seed, 1);
+      } else
+#endif
+      {
+          generateRandomMatrix(A, storage.M, K, shape.lda, seed, 0);
+          generateRandomMatrix(B, storage.K, N, shape.ldb, seed, 1);
+      }
+  }
+
+  if (structured && loadA.empty()) structureMatrix(A, M, K, shape.lda, structure, density, seed);
+  if (structure != "general" && !loadA.empty() && !hasStructure(A, M, shape.lda, structure)) {
+      cerr << "Mode " << mode << " reads half of A, so it needs " << (structure == "symmetric" ? "a symmetric" : "an upper triangular")
+           << " A, but " << loadA << " is not." << endl;
+      return 1;
+  }
+  if (options.count("save-a") || options.count("save-b")) {
+      auto start = high_resolution_clock::now();
+      if (options.count("save-a") && !saveMatrixFile(options["save-a"], M, K, A, shape.lda)) return 1;
+      if (options.count("save-b") && !saveMatrixFile(options["save-b"], K, N, B, shape.ldb)) return 1;
+      save_time += duration<double>(high_resolution_clock::now() - start).count();
+  }
+
+  // Mode 14 builds the CSR form of A outside the timed loop (Convert_time);
+  // the dense A stays for --check and --verify.
+  CsrMatrix csr;
+  double convert_time = 0.0;
+  long long nnz = 0;
+  if (mode == 14) {
+      auto start = high_resolution_clock::now();
+      csr = denseToCsr(M, K, A, shape.lda);
+      convert_time = duration<double>(high_resolution_clock::now() - start).count();
+      nnz = csr.rowStart[M];
+  } else if (structured) {
+      for (idx_t i = 0; i < M; i++) nnz += count_if(&A[i * shape.lda], &A[i * shape.lda + K], [](double a) { return a != 0.0; });
+  }
+
+  // Narrow dtypes run on rounded copies of the f64 inputs; C is float for both.
+  float *A32 = nullptr, *B32 = nullptr, *C32 = nullptr;
+  bf16 *A16 = nullptr, *B16 = nullptr;
+  if (dtype == "f32") {
+      if (!matrixMemoryAllocation(A32, B32, C32, shape, options.count("hugepages") > 0, rowsPerChunk)) return 1;
+      convertMatrix(M, K, A, shape.lda, A32, shape.lda);
+      convertMatrix(K, N, B, shape.ldb, B32, shape.ldb);
+  } else if (dtype == "bf16") {
+      if (!matrixMemoryAllocation(A16, B16, C32, shape, options.count("hugepages") > 0, rowsPerChunk)) return 1;
+      convertMatrix(M, K, A, shape.lda, A16, shape.lda);
+      convertMatrix(K, N, B, shape.ldb, B16, shape.ldb);
+  }
+
+  // Mode 6 transposes B once, outside the timed iterations, and reports it apart.
+  double *Bt = nullptr;
+  double transpose_time = 0.0;
+  if (mode == 6) {
+      Bt = allocMatrix((size_t)N * K, options.count("hugepages") > 0);
+      if (!Bt) return 1;
+      firstTouch(Bt, N, K, DOT_TILE);
+      auto start = high_resolution_clock::now();
+      transposeBlocked(K, N, B, shape.ldb, Bt, K);
+      transpose_time = duration<double>(high_resolution_clock::now() - start).count();
+  }
+
+  // The Strassen arena is allocated once, outside the timed iterations.
+  double *arena = nullptr;
+  if (mode == 8) {
+      size_t words = strassenWorkspace(M, N, K, strassen, 0);
+      arena = allocMatrix(max<size_t>(words, 1), false);
+      if (!arena) {
+          cerr << "Cannot allocate the " << words * sizeof(double) / 1048576 << " MB Strassen arena." << endl;
+          return 1;
+      }
+  }
+
+  // Mode 9 works on tiled views; with --morton A and B are converted once
+  // outside the timed iterations and C is converted back inside them.
+  TiledView recA, recB, recC;
+  bool morton = options.count("morton") > 0;
+  double layout_time = 0.0;
+  if (mode == 9) {
+      recA = rowMajorView(A, M, K, shape.lda);
+      recB = rowMajorView(B, K, N, shape.ldb);
+      recC = rowMajorView(C, M, N, shape.ldc);
+      if (morton) {
+          if (!allocMortonView(M, K, recA) || !allocMortonView(K, N, recB) || !allocMortonView(M, N, recC)) {
+              cerr << "Error allocating the Morton-layout matrices!" << endl;
+              return 1;
+          }
+          auto start = high_resolution_clock::now();
+          toMorton(A, shape.lda, recA);
+          toMorton(B, shape.ldb, recB);
+          layout_time = duration<double>(high_resolution_clock::now() - start).count();
+      }
+  }
+
+  vector<const double *> batchA(batch), batchB(batch);
+  vector<double *> batchC(batch);
+  for (idx_t b = 0; b < batch; b++) {
+      batchA[b] = A + b * M * shape.lda;
+      batchB[b] = B + b * K * shape.ldb;
+      batchC[b] = C + b * M * shape.ldc;
+  }
+
+  StreamTimes stream_times = {0.0, 0.0};
+  StealStats steal_stats;
+  StealStats *stealing = steal ? &steal_stats : nullptr;
+  DeviceTimes device_times = {0.0, 0.0, 0.0};
+#ifdef CPD_MPI
+  SummaTimes summa_times = {0.0, 0.0, 0.0};
+#endif
+  auto runKernel = [&]() {
+      const idx_t lda = shape.lda, ldb = shape.ldb, ldc = shape.ldc;
+      if (dtype == "f32") {
+          runTypedKernel(mode, parallel_1, parallel_2, bk, shape, A32, B32, C32, stealing);
+      } else if (dtype == "bf16") {
+          runTypedKernel(mode, parallel_1, parallel_2, bk, shape, A16, B16, C32, stealing);
+      } else if (mode == 1) {
+          OnMult(M, N, K, A, lda, B, ldb, C, ldc);
+      } else if (mode == 2) {
+          if (stealing) {
+              OnMultLine_stealing(M, N, K, A, lda, B, ldb, C, ldc, *stealing);
+          }
+          else if (parallel_1) {
+              OnMultLine_parallel_1(M, N, K, A, lda, B, ldb, C, ldc);
+          }
+          else if (parallel_2) {
+              OnMultLine_parallel_2(M, N, K, A, lda, B, ldb, C, ldc);
+          }
+          else {
+              OnMultLine(M, N, K, A, lda, B, ldb, C, ldc);
+          }
+      } else if (mode == 3) {
+          if (stealing) {
+              OnMultBlock_stealing(M, N, K, bk, A, lda, B, ldb, C, ldc, *stealing);
+          }
+          else if (parallel_1) {
+              OnMultBlock_parallel(M, N, K, bk, A, lda, B, ldb, C, ldc);
+          }
+          else {
+              OnMultBlock(M, N, K, bk, A, lda, B, ldb, C, ldc);
+          }
+      } else if (mode == 5) {
+          OnMultPacked(M, N, K, A, lda, B, ldb, C, ldc, parallel_1);
+      } else if (mode == 6) {
+          OnMultDot(M, N, K, A, lda, Bt, K, C, ldc, parallel_1);
+      } else if (mode == 7) {
+          stream_times = OnMultStream(M, N, K, bk, panelM, panelK, A, B, C, parallel_1);
+      } else if (mode == 8) {
+          OnMultStrassen(M, N, K, A, lda, B, ldb, C, ldc, strassen, arena, parallel_1);
+      } else if (mode == 9) {
+          OnMultRecursive(recA, recB, recC, parallel_1);
+          if (morton) fromMorton(recC, C, ldc);
+      } else if (mode == 10) {
+          gemm(M, N, K, 1.0, A, lda, B, ldb, 0.0, C, ldc);
+      } else if (mode == 11) {
+          gemmBatched(batch, M, N, K, 1.0, batchA.data(), lda, batchB.data(), ldb, 0.0, batchC.data(), ldc);
+      } else if (mode == 14) {
+          OnMultCsr(csr, N, B, ldb, C, ldc, parallel_1);
+      } else if (mode == 15) {
+          OnMultSymmetric(M, N, bk, A, lda, B, ldb, C, ldc, parallel_1);
+      } else if (mode == 16) {
+          OnMultTriangular(M, N, bk, A, lda, B, ldb, C, ldc, parallel_1);
+      } else if (mode == 13) {
+          device_times = OnMultDevice(M, N, K, 1.0, A, lda, B, ldb, 0.0, C, ldc);
+      } else if (mode == 12) {
+#ifdef CPD_MPI
+          summa_times = OnMultSumma(grid, panelK, A, B, C, overlap);
+#endif
+      } else if (mode == MODE_VARIANT) {
+          variant->run(M, N, K, A, lda, B, ldb, C, ldc);
+      }
+  };
+
+  // Counters for every thread the run may use (the autotuner only narrows the team).
+  vector<string> eventList;
+  istringstream eventText(getOption(options, "papi-events", DEFAULT_EVENTS));
+  for (string name; getline(eventText, name, ',');) if (!name.empty()) eventList.push_back(name);
+  // DRAM traffic comes from --dram-event (counts times BYTES, default one cache
+  // line per count), else from the L3 misses, else from estimateDramBytes.
+  string dramEvent = getOption(options, "dram-event", "");
+  double dramScale = CACHE_LINE_BYTES;
+  if (dramEvent.find('*') != string::npos) {
+      dramScale = atof(dramEvent.substr(dramEvent.find('*') + 1).c_str());
+      dramEvent = dramEvent.substr(0, dramEvent.find('*'));
+  }
+  if (!dramEvent.empty() && find(eventList.begin(), eventList.end(), dramEvent) == eventList.end()) {
+      eventList.push_back(dramEvent);
+  }
+  // Modes 10 to 12 run on the library's worker pool, started here with its
+  // counters so neither the threads nor their event sets are created inside the timing.
+  ThreadCounters papi;
+  if (mode == 10 || mode == 11 || mode == 12) {
+      gemmSetThreads(parallel_1 ? omp_get_max_threads() : 1);
+      papi.onPool = true;
+      if (!places.empty()) gemmForEachWorker([&](int w) { pinCurrentThread(places[w % places.size()]); });
+  }
+  if (!papi.init(eventList, papi.onPool ? gemmThreads() : omp_get_max_threads())) return 1;
+  const size_t numEvents = papi.names.size();
+
+  if (runAutotune) {
+      TuneResult best = autotuneBlock(M, N, K, A, shape.lda, B, shape.ldb, C, shape.ldc, parallel_1, options.count("threads") > 0, papi);
+      bk = best.bk;
+      hasBlock = true;
+      tuning = "autotune";
+      if (!saveTuning(tuneCache, tuneKeyText, best)) cerr << "Cannot write the tuning cache " << tuneCache << "." << endl;
+  }
+
+  for (int it = 0; it < warmup; it++) runKernel();
+
+  vector<double> times, stream_waits, stream_computes, summa_computes, summa_comms, summa_waits;
+  vector<double> device_h2d, device_kernel, device_d2h;
+  // Stealing schedule: per thread, the busy and idle time of each iteration.
+  vector<vector<double>> steal_busy, steal_idle;
+  vector<double> steal_counts, steal_imbalance;
+  // Per event: the all-thread totals of each iteration, and each thread's own values.
+  vector<vector<double>> counters(numEvents);
+  vector<vector<vector<double>>> threadCounters(numEvents, vector<vector<double>>(papi.sets.size()));
+  // --verify checks every timed result with Freivalds' test, outside the timing
+  // window; --check stays the exact (O(n^3)) compare for small sizes.
+  int verifyRounds = atoi(getOption(options, "verify", "0").c_str());
+  string verify = verifyRounds > 0 ? "pass" : "skipped";
+  double verify_error = 0.0;
+#ifdef CPD_TRACE
+  if (!tracePath.empty()) traceStart();
+#endif
+  for (int it = 0; it < iterations; it++) {
+#ifdef CPD_MPI
+      // The ranks start each iteration together.
+      if (mode == 12) MPI_Barrier(grid.world);
+#endif
+      papi.start();
+      auto start = high_resolution_clock::now();
+      {
+          TRACE_SPAN("iteration");
+          runKernel();
+      }
+      auto end = high_resolution_clock::now();
+      papi.stop();
+
+      if (verifyRounds > 0 && mode == 12) {
+#ifdef CPD_MPI
+          double err = summaFreivaldsError(grid, A, B, C, verifyRounds, seed, 2 + (uint64_t)it * verifyRounds);
+          verify_error = max(verify_error, err);
+          if (err > checkTolerance(dtype)) verify = "FAIL";
+#endif
+      } else if (verifyRounds > 0) {
+          // Streams 0 and 1 are A and B; each iteration, problem and round draws its own r.
+          for (idx_t b = 0; b < batch; b++) {
+              uint64_t stream = 2 + ((uint64_t)it * batch + b) * verifyRounds;
+              const double *Ab = batchA[b], *Bb = batchB[b];
+              double err = dtype == "f64"
+                  ? freivaldsError(M, N, K, Ab, shape.lda, Bb, shape.ldb, batchC[b], shape.ldc, verifyRounds, seed, stream)
+                  : freivaldsError(M, N, K, Ab, shape.lda, Bb, shape.ldb, C32, shape.ldc, verifyRounds, seed, stream);
+              verify_error = max(verify_error, err);
+              if (err > checkTolerance(dtype)) verify = "FAIL";
+          }
+      }
+
+      times.push_back(duration<double>(end - start).count());
+      stream_waits.push_back(stream_times.wait);
+      stream_computes.push_back(stream_times.compute);
+      if (steal) {
+          size_t team = steal_stats.busy.size();
+          steal_busy.resize(team);
+          steal_idle.resize(team);
+          double most = 0.0, total = 0.0;
+          for (size_t t = 0; t < team; t++) {
+              steal_busy[t].push_back(steal_stats.busy[t]);
+              steal_idle[t].push_back(steal_stats.idle[t]);
+              most = max(most, steal_stats.busy[t]);
+              total += steal_stats.busy[t];
+          }
+          steal_counts.push_back(accumulate(steal_stats.steals.begin(), steal_stats.steals.end(), 0.0));
+          steal_imbalance.push_back(total > 0 ? most * team / total : 0.0);
+      }
+      device_h2d.push_back(device_times.h2d);
+      device_kernel.push_back(device_times.kernel);
+      device_d2h.push_back(device_times.d2h);
+#ifdef CPD_MPI
+      summa_computes.push_back(summa_times.compute);
+      summa_comms.push_back(summa_times.comm);
+      summa_waits.push_back(summa_times.wait);
+#endif
+      for (size_t e = 0; e < numEvents; e++) {
+          counters[e].push_back((double)papi.total(e));
+          for (size_t t = 0; t < papi.sets.size(); t++) threadCounters[e][t].push_back((double)papi.values[t][e]);
+      }
+  }
+  // Time per iteration in each traced phase, summed over the threads.
+  vector<pair<string, double>> trace_phases;
+  size_t trace_events = 0;
+#ifdef CPD_TRACE
+  if (!tracePath.empty()) {
+      traceStop();
+      trace_phases = tracePhaseTotals(trace_events);
+      for (auto &phase : trace_phases) phase.second /= iterations;
+      if (!traceWriteChrome(tracePath)) return 1;
+  }
+#endif
+
+  // Optional exact check of the last result against the simple kernel. Strassen
+  // and the narrow dtypes trade accuracy for speed, so they always report it
+  // (against the f64 OnMult) unless --check=0.
+  string check = "skipped";
+  double check_error = 0.0;
+  if (getOption(options, "check", (mode == 8 || dtype != "f64") ? "1" : "0") != "0") {
+      double *R = allocMatrix((size_t)M * N, false);
+      if (!R) return 1;
+      for (idx_t b = 0; b < batch; b++) {
+          OnMult(M, N, K, (double *)batchA[b], shape.lda, (double *)batchB[b], shape.ldb, R, N);
+          check_error = max(check_error, dtype == "f64" ? relativeError(M, N, batchC[b], shape.ldc, R, N)
+                                                        : relativeError(M, N, C32, shape.ldc, R, N));
+      }
+      check = check_error <= checkTolerance(dtype) ? "pass" : "FAIL";
+      freeMatrix(R);
+  }
+
+  // The result of the last iteration, in float for the narrow dtypes.
+  if (options.count("save-c")) {
+      auto start = high_resolution_clock::now();
+      bool saved = dtype == "f64" ? saveMatrixFile(options["save-c"], M, N, C, shape.ldc)
+                                  : saveMatrixFile(options["save-c"], M, N, C32, shape.ldc);
+      if (!saved) return 1;
+      save_time += duration<double>(high_resolution_clock::now() - start).count();
+  }
+
+  // Mode 12: an iteration lasts as long as its slowest rank and the counters
+  // are totals over the ranks; rank 0 gathers each rank's median compute,
+  // broadcast and wait times.
+  int ranks = 1;
+  string gridName = "-";
+  vector<double> rankTimes = {computeStats(summa_computes).median, computeStats(summa_comms).median,
+                              computeStats(summa_waits).median};
+#ifdef CPD_MPI
+  if (mode == 12) {
+      ranks = grid.ranks;
+      gridName = to_string(grid.rows) + "x" + to_string(grid.cols);
+      MPI_Allreduce(MPI_IN_PLACE, times.data(), iterations, MPI_DOUBLE, MPI_MAX, grid.world);
+      for (auto &c : counters) MPI_Allreduce(MPI_IN_PLACE, c.data(), iterations, MPI_DOUBLE, MPI_SUM, grid.world);
+      vector<double> mine = rankTimes;
+      rankTimes.resize(3 * ranks);
+      MPI_Gather(mine.data(), 3, MPI_DOUBLE, rankTimes.data(), 3, MPI_DOUBLE, 0, grid.world);
+  }
+#endif
+  auto slowestRank = [&](int field) {
+      double worst = 0.0;
+      for (int r = 0; r < ranks; r++) worst = max(worst, rankTimes[3 * r + field]);
+      return worst;
+  };
+
+  Stats time_stats = computeStats(times);
+  vector<Stats> counter_stats(numEvents);
+  for (size_t e = 0; e < numEvents; e++) counter_stats[e] = computeStats(counters[e]);
+  int dpOps = papi.find("PAPI_DP_OPS");
+
+  // Only the parallel variants fan out; the serial kernels always run on one thread.
+  bool ran_parallel = (mode == 2 && (parallel_1 || parallel_2)) || ((mode == 3 || mode == 5 || mode == 6 || mode == 7 || mode == 8 || mode == 9 || mode == 10 || mode == 11 || mode == 12 || mode == 14 || mode == 15 || mode == 16) && parallel_1);
+  int threads = ran_parallel ? omp_get_max_threads() : 1;
+
+  // Analytical rate from the 2MNK (2n^3) operation count next to the PAPI_DP_OPS rate;
+  // a gap between them or a low share of peak flags a de-vectorised kernel.
+  // SpMM counts its nonzeros and the triangular product its upper triangle.
+  double flops = 2.0 * M * N * K * batch;
+  if (mode == 14) flops = 2.0 * nnz * N;
+  else if (mode == 16) flops = (double)M * (M + 1) * N;
+  double gflops = flops / time_stats.median / 1e9;
+  double dp_gflops = dpOps >= 0 ? counter_stats[dpOps].median / time_stats.median / 1e9 : 0.0;
+  double peak_per_core = options.count("peak-gflops") ? atof(options["peak-gflops"].c_str()) : detectPeakGflopsPerCore();
+  double peak = peak_per_core * threads * ranks;
+
+  // Roofline placement of this run; --roofline=0 skips the two probes. They
+  // measure the host of one rank, so modes 12 and 13 leave them off unless asked.
+  bool roofline = getOption(options, "roofline", mode == 12 || mode == 13 ? "0" : "1") != "0";
+  size_t llcBytes = lastLevelCacheBytes();
+  size_t inBytes = dtype == "f64" ? sizeof(double) : dtype == "f32" ? sizeof(float) : sizeof(bf16);
+  size_t cBytes = dtype == "f64" ? sizeof(double) : sizeof(float);
+  string dramSource = "model";
+  double dramBytes = estimateDramBytes(mode, M, N, K, bk, llcBytes, inBytes, cBytes) * batch;
+  int dramIndex = dramEvent.empty() ? papi.find("PAPI_L3_TCM") : papi.find(dramEvent);
+  if (dramIndex >= 0 && counter_stats[dramIndex].median > 0) {
+      dramBytes = counter_stats[dramIndex].median * (dramEvent.empty() ? CACHE_LINE_BYTES : dramScale);
+      dramSource = papi.names[dramIndex];
+  }
+  double intensity = dramBytes > 0 ? flops / dramBytes : 0.0;
+  double stream_gbs = roofline ? streamTriadGBs(threads, llcBytes) : 0.0;
+  double probe_gflops = roofline ? probePeakGflops(threads) : 0.0;
+  double roof = min(probe_gflops, intensity * stream_gbs);
+  string bound = !roofline ? "-" : intensity * stream_gbs < probe_gflops ? "memory" : "compute";
+
+  // Print results in CSV format to stdout. The leading columns keep their
+  // historical layout and hold medians; the per-metric statistics follow.
+  CsvRow row;
+  row.add("Matrix Size", (M == N && N == K) ? to_string(M) : to_string(M) + "x" + to_string(K) + "x" + to_string(N));
+  row.add("Time", time_stats.median);
+  // Historical counter columns: thread totals, or "-" when the event is not in --papi-events.
+  for (const char *event : {"PAPI_DP_OPS", "PAPI_L1_DCM", "PAPI_L2_DCM", "PAPI_L3_TCM"}) {
+      int e = papi.find(event);
+      if (e >= 0) row.add(eventColumn(event), counter_stats[e].median, 15);
+      else row.add(eventColumn(event), "-");
+  }
+  row.add("Threads", to_string(threads));
+  row.add("ISA", kern.isa);
+  row.add("Dtype", dtype);
+  row.add("GFLOPS", gflops);
+  row.add("GFLOPS_best", flops / time_stats.min / 1e9);
+  row.add("DP_GFLOPS", dp_gflops);
+  row.add("Peak_GFLOPS", peak);
+  row.add("Peak_pct", peak > 0 ? 100.0 * gflops / peak : 0.0, 4);
+  row.add("DRAM_bytes", dramBytes, 15);
+  row.add("DRAM_source", dramSource);
+  row.add("DRAM_GBs", dramBytes / time_stats.median / 1e9);
+  row.add("AI", intensity);
+  row.add("STREAM_GBs", stream_gbs);
+  row.add("Probe_GFLOPS", probe_gflops);
+  row.add("Ridge_AI", stream_gbs > 0 ? probe_gflops / stream_gbs : 0.0);
+  row.add("Roof_GFLOPS", roof);
+  row.add("Roof_pct", roof > 0 ? 100.0 * gflops / roof : 0.0, 4);
+  row.add("Bound", bound);
+  // Loaded operands were not generated, so the seed only describes a generated one.
+  row.add("Seed", !loadA.empty() && !loadB.empty() ? "-" : to_string(seed));
+  row.add("Iterations", to_string(iterations));
+  row.add("Warmup", to_string(warmup));
+  row.add("M", to_string(M));
+  row.add("N", to_string(N));
+  row.add("K", to_string(K));
+  row.add("Block", hasBlock ? to_string(bk.m) + "x" + to_string(bk.k) + "x" + to_string(bk.n) : "-");
+  row.add("Variant", variant ? variant->name : "-");
+  row.add("Order", (mode == 3 || mode == 7 || mode == 8) ? tileOrderName(bk.order) : "-");
+  row.add("Tuning", tuning);
+  row.add("Transpose_time", transpose_time);
+  row.add("Layout", mode == 9 ? (morton ? "morton" : "rowmajor") : "-");
+  row.add("Layout_time", layout_time);
+  row.add("Structure", structure);
+  row.add("Density", density);
+  row.add("NNZ", structured || mode == 14 ? to_string(nnz) : "-");
+  row.add("Convert_time", convert_time);
+  row.add("Input_A", loadA.empty() ? "generated" : loadA);
+  row.add("Input_B", loadB.empty() ? "generated" : loadB);
+  row.add("Load_time", load_time);
+  row.add("Save_time", save_time);
+  row.add("Stream_wait_time", computeStats(stream_waits).median);
+  row.add("Stream_compute_time", computeStats(stream_computes).median);
+  row.add("Cutoff", mode == 8 ? to_string(strassen.cutoff) : "-");
+  row.add("Batch", to_string(batch));
+  row.add("Matrices_per_s", batch / time_stats.median);
+  row.add("Ranks", to_string(ranks));
+  row.add("Grid", gridName);
+  row.add("Panel_k", mode == 12 ? to_string(panelK) : "-");
+  row.add("Overlap", mode == 12 ? (overlap ? "1" : "0") : "-");
+  row.add("Compute_time", slowestRank(0));
+  row.add("Comm_time", slowestRank(1));
+  row.add("Comm_wait_time", slowestRank(2));
+  row.add("Schedule", (mode == 2 || mode == 3) && ran_parallel ? schedule : "-");
+  row.add("Steals", computeStats(steal_counts).median);
+  row.add("Imbalance", computeStats(steal_imbalance).median);
+  row.add("Bind", bindName);
+  row.add("SMT", bind == "none" ? "-" : smt ? "on" : "off");
+  row.add("Places", places.empty() ? "-" : placesText);
+  row.add("Topology", topologySummary(topology));
+  row.add("Device", device);
+  row.add("Pinned", pinned ? "1" : "0");
+  row.add("H2D_time", computeStats(device_h2d).median);
+  row.add("Kernel_time", computeStats(device_kernel).median);
+  row.add("D2H_time", computeStats(device_d2h).median);
+  row.add("Trace", tracePath.empty() ? "-" : tracePath);
+  row.add("Trace_events", to_string(trace_events));
+  for (auto &phase : trace_phases) row.add("Trace_" + phase.first + "_time", phase.second);
+  row.add("Check", check);
+  row.add("Check_error", check_error);
+  row.add("Verify", verify);
+  row.add("Verify_error", verify_error);
+  // Run metadata, so a row is self-describing outside its results directory.
+  row.add("Mode", modeName(mode, variant));
+  row.add("Parallel_flag", args[3]);
+  row.add("Compiler", CPD_COMPILER);
+  row.add("Build_flags", CPD_BUILD_FLAGS);
+  row.add("CPU_model", cpuModel());
+  row.add("Host", hostName());
+  row.add("Timestamp", timestampUtc());
+  row.addStats("Time", time_stats);
+  row.add("PAPI_multiplexed", papi.multiplexed ? "1" : "0");
+  for (size_t e = 0; e < numEvents; e++) row.addStats(eventColumn(papi.names[e]), counter_stats[e], 15);
+  // Per-thread medians; serial kernels leave all but thread 0 near zero.
+  for (size_t e = 0; e < numEvents; e++) {
+      for (int t = 0; t < papi.team; t++) {
+          row.add(eventColumn(papi.names[e]) + "_thread" + to_string(t), computeStats(threadCounters[e][t]).median, 15);
+      }
+  }
+  for (size_t t = 0; t < steal_busy.size(); t++) {
+      row.add("Busy_time_thread" + to_string(t), computeStats(steal_busy[t]).median);
+      row.add("Idle_time_thread" + to_string(t), computeStats(steal_idle[t]).median);
+  }
+  if (mode == 12) {
+      for (int r = 0; r < ranks; r++) {
+          row.add("Rank" + to_string(r) + "_compute_time", rankTimes[3 * r]);
+          row.add("Rank" + to_string(r) + "_comm_time", rankTimes[3 * r + 1]);
+          row.add("Rank" + to_string(r) + "_wait_time", rankTimes[3 * r + 2]);
+      }
+  }
+  if (mpiRank == 0) {
+      row.print(cout);
+      if (options.count("results")) {
+          ofstream store(options["results"], ios::app);
+          row.printJson(store);
+          if (!store) cerr << "Cannot append to the results store " << options["results"] << "." << endl;
+      }
+  }
+
+  if (mode == 7) {
+      unmapMatrixFile(mapA);
+      unmapMatrixFile(mapB);
+      unmapMatrixFile(mapC);
+  } else if (pinned) {
+      freePinned(A);
+      freePinned(B);
+      freePinned(C);
+  } else {
+      if (loadA.empty()) freeMatrix(A);
+      else closeMatrixFile(fileA);
+      if (loadB.empty()) freeMatrix(B);
+      else closeMatrixFile(fileB);
+      freeMatrix(C);
+  }
+  freeMatrix(Bt);
+  freeMatrix(A32);
+  freeMatrix(B32);
+  freeMatrix(C32);
+  freeMatrix(A16);
+  freeMatrix(B16);
+  freeMatrix(arena);
+  if (morton) {
+      freeMatrix(recA.data);
+      freeMatrix(recB.data);
+      freeMatrix(recC.data);
+  }
+#ifdef CPD_MPI
+  if (mode == 12) freeSummaGrid(grid);
+#endif
+
+  if (check == "FAIL") {
+      cerr << "Result check against OnMult failed (relative error " << check_error << ")." << endl;
+      return 2;
+  }
+  if (verify == "FAIL") {
+      cerr << "Freivalds verification failed (error " << verify_error << " of the rounding bound)." << endl;
+      return 2;
+  }
+  return 0;
 }
\ No newline at end of file
@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+"""Performance regression suite for the C++ benchmark and the Rust crate.
+
+Runs a fixed matrix of (kernel, size, block, threads) cases in ./multiplication
+and in ../mul-rust, compares GFLOPS (both) and L1/L2/L3 misses (C++ only; the
+Rust crate has no counters) with the stored baseline, prints one summary table
+and exits with status 1 when any case regressed.
+
+    ./regression.py                      # build if needed, run, compare
+    ./regression.py --update             # run and store the results as the baseline
+    ./regression.py --threshold=5 --only=block
+
+A case regresses when its GFLOPS fall, or its misses grow, by more than the
+threshold or by NOISE_SIGMAS times the combined relative noise of the baseline
+and the current run, whichever is larger; so noisy cases need a larger change
+before they fail, and the table shows the margin each case was held to.
+"""
+
+import argparse
+import json
+import math
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+from datetime import datetime, timezone
+
+# (kernel, size, block, threads). Single-threaded cases also run in Rust, which
+# has no parallel kernels.
+CASES = [
+    ('simple', 600, None, 1),
+    ('simple', 1000, None, 1),
+    ('line', 1000, None, 1),
+    ('line', 2048, None, 1),
+    ('line', 2048, None, 4),
+    ('block', 1000, 128, 1),
+    ('block', 2048, 128, 1),
+    ('block', 2048, 256, 1),
+    ('block', 2048, 256, 4),
+]
+
+CPP_MODES = {'simple': 1, 'line': 2, 'block': 3}
+RUST_MODES = {'simple': 'n', 'line': 'l', 'block': 'b'}
+MISS_COLUMNS = ['L1_misses', 'L2_misses', 'L3_misses']
+
+NOISE_SIGMAS = 3.0
+SRC = os.path.dirname(os.path.abspath(__file__))
+RUST_DIR = os.path.join(SRC, '..', 'mul-rust')
+RUST_BINARY = os.path.join(RUST_DIR, 'target', 'release', 'mul-rust')
+
+
+def case_key(impl, kernel, size, block, threads):
+    return '%s/%s/%d/%s/%dt' % (impl, kernel, size, block or '-', threads)
+
+
+def relative_noise(values):
+    """Standard deviation over mean of repeated measurements (0 for a single one)."""
+    if len(values) < 2 or statistics.mean(values) == 0:
+        return 0.0
+    return statistics.stdev(values) / statistics.mean(values)
+
+
+def run_cpp(kernel, size, block, threads, iterations):
+    """Runs one case in-process for iterations timed runs and returns its metrics."""
+    fd, store = tempfile.mkstemp(suffix='.jsonl')
+    os.close(fd)
+    parallel = 1 if threads > 1 else 0
+    args = ['./multiplication', str(CPP_MODES[kernel]), str(size), str(iterations), str(parallel)]
+    if block:
+        args.append(str(block))
+    args += ['--threads=%d' % threads, '--warmup=1', '--roofline=0', '--results=' + store]
+    try:
+        subprocess.run(args, cwd=SRC, check=True, stdout=subprocess.DEVNULL)
+        with open(store) as f:
+            run = json.loads(f.readline())
+    finally:
+        os.remove(store)
+
+    # GFLOPS is the median-time rate, so its relative noise is that of the time.
+    time = float(run['Time_median'])
+    result = {
+        'gflops': float(run['GFLOPS']),
+        'gflops_noise': float(run['Time_stddev']) / time if time > 0 else 0.0,
+        'cpu_model': run.get('CPU_model', ''),
+    }
+    for column in MISS_COLUMNS:
+        median = run.get(column + '_median', '-')
+        if median in ('-', None):
+            continue
+        median = float(median)
+        result[column] = median
+        result[column + '_noise'] = float(run[column + '_stddev']) / median if median > 0 else 0.0
+    return result
+
+
+def run_rust(kernel, size, block, repeats):
+    """The Rust binary times one multiplication per process, so a case is repeats processes."""
+    args = [RUST_BINARY, RUST_MODES[kernel], str(size)]
+    if block:
+        args.append(str(block))
+    gflops = []
+    for _ in range(repeats):
+        out = subprocess.run(args, check=True, capture_output=True, text=True).stdout.split()
+        seconds = float(out[-1])
+        gflops.append(2.0 * size ** 3 / seconds / 1e9)
+    return {'gflops': statistics.median(gflops), 'gflops_noise': relative_noise(gflops)}
+
+
+def build(rebuild):
+    if rebuild and os.path.exists(os.path.join(SRC, 'multiplication')):
+        os.remove(os.path.join(SRC, 'multiplication'))
+    subprocess.run(['./script.sh'], cwd=SRC, check=True, env=dict(os.environ, BUILD_ONLY='1'))
+    subprocess.run(['cargo', 'build', '--release', '--quiet'], cwd=RUST_DIR, check=True)
+
+
+def compare(current, baseline, threshold, higher_is_better):
+    """Returns (change, allowed margin, status) for one metric."""
+    noise = math.hypot(current['noise'], baseline['noise'])
+    allowed = max(threshold, NOISE_SIGMAS * noise)
+    change = current['value'] / baseline['value'] - 1.0 if baseline['value'] else 0.0
+    worse = -change if higher_is_better else change
+    if worse > allowed:
+        return change, allowed, 'FAIL'
+    if -worse > allowed:
+        return change, allowed, 'better'
+    return change, allowed, 'ok'
+
+
+def percent(x):
+    return '%+.1f%%' % (100.0 * x)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--baseline', default=os.path.join(SRC, 'regression_baseline.json'))
+    parser.add_argument('--update', action='store_true', help='store this run as the baseline')
+    parser.add_argument('--threshold', type=float, default=10.0, help='allowed GFLOPS drop in percent')
+    parser.add_argument('--miss-threshold', type=float, default=25.0, help='allowed cache miss growth in percent')
+    parser.add_argument('--iterations', type=int, default=5, help='timed runs per case')
+    parser.add_argument('--only', default='', help='run the cases whose key contains this text')
+    parser.add_argument('--summary', default='regression_summary.csv', help='CSV copy of the table')
+    parser.add_argument('--rebuild', action='store_true', help='rebuild ./multiplication first')
+    parser.add_argument('--no-rust', action='store_true')
+    args = parser.parse_args()
+
+    build(args.rebuild)
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    cases = baseline.get('cases', {})
+
+    results = {}
+    for kernel, size, block, threads in CASES:
+        impls = ['cpp'] if threads > 1 or args.no_rust else ['cpp', 'rust']
+        for impl in impls:
+            key = case_key(impl, kernel, size, block, threads)
+            if args.only not in key:
+                continue
+            print('Running %s...' % key, file=sys.stderr)
+            if impl == 'cpp':
+                results[key] = run_cpp(kernel, size, block, threads, args.iterations)
+            else:
+                results[key] = run_rust(kernel, size, block, args.iterations)
+
+    cpu = next((r['cpu_model'] for r in results.values() if r.get('cpu_model')), platform.processor())
+    if cases and baseline.get('cpu_model') != cpu:
+        print('Warning: the baseline was measured on %s, this is %s.' % (baseline.get('cpu_model'), cpu),
+              file=sys.stderr)
+
+    header = ['Case', 'Base_GFLOPS', 'GFLOPS', 'Change', 'Allowed'] + \
+             [c.split('_')[0] + '_change' for c in MISS_COLUMNS] + ['Status']
+    rows = []
+    failed = False
+    for key, current in results.items():
+        base = cases.get(key)
+        if not base:
+            rows.append([key, '-', '%.3f' % current['gflops'], '-', '-'] + ['-'] * len(MISS_COLUMNS) + ['new'])
+            continue
+        change, allowed, status = compare({'value': current['gflops'], 'noise': current['gflops_noise']},
+                                          {'value': base['gflops'], 'noise': base['gflops_noise']},
+                                          args.threshold / 100.0, True)
+        misses = []
+        for column in MISS_COLUMNS:
+            if column not in current or column not in base:
+                misses.append('-')
+                continue
+            miss_change, _, miss_status = compare(
+                {'value': current[column], 'noise': current[column + '_noise']},
+                {'value': base[column], 'noise': base[column + '_noise']},
+                args.miss_threshold / 100.0, False)
+            misses.append(percent(miss_change) + ('!' if miss_status == 'FAIL' else ''))
+            if miss_status == 'FAIL' and status != 'FAIL':
+                status = 'FAIL (misses)'
+        failed = failed or status.startswith('FAIL')
+        rows.append([key, '%.3f' % base['gflops'], '%.3f' % current['gflops'], percent(change),
+                     '%.1f%%' % (100.0 * allowed)] + misses + [status])
+
+    widths = [max(len(str(r[i])) for r in [header] + rows) for i in range(len(header))]
+    for r in [header] + rows:
+        print('  '.join(str(v).ljust(w) for v, w in zip(r, widths)).rstrip())
+    with open(args.summary, 'w') as f:
+        for r in [header] + rows:
+            f.write(','.join(str(v) for v in r) + '\n')
+
+    if args.update:
+        cases.update(results)
+        with open(args.baseline, 'w') as f:
+            json.dump({'cpu_model': cpu, 'host': platform.node(),
+                       'updated': datetime.now(timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ'),
+                       'cases': cases}, f, indent=1, sort_keys=True)
+        print('Baseline written to %s.' % args.baseline, file=sys.stderr)
+        return 0
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -6,19 +6,57 @@ if ! ldconfig -p | grep -q libpapi; then
     exit 1
 fi
 
+# Compile the library and the program if necessary. The kernels and gemm() go
+# into libcpdgemm.a and libcpdgemm.so (include cpdgemm.h, link with -fopenmp);
+# the benchmark links the static one.
+EXECUTABLE="./multiplication"
+CXXFLAGS="-O2 -fopenmp"
+# OFFLOAD=nvptx-none (or amdgcn-amdhsa) builds the device kernel of mode 13 for
+# that GPU; without it the OpenMP target regions run on the host.
+if [ -n "$OFFLOAD" ]; then
+    CXXFLAGS="$CXXFLAGS -foffload=$OFFLOAD"
+fi
+# TRACE=1 compiles in the hot-path spans, for --trace=FILE (Chrome trace JSON).
+if [ "$TRACE" == "1" ]; then
+    CXXFLAGS="$CXXFLAGS -DCPD_TRACE"
+fi
+if [ ! -f "$EXECUTABLE" ]; then
+    echo "Compiling the library..."
+    g++ -c kernels.cpp -o kernels.o $CXXFLAGS -fPIC || exit 1
+    g++ -c gemm.cpp -o gemm.o $CXXFLAGS -fPIC || exit 1
+    ar rcs libcpdgemm.a kernels.o gemm.o || exit 1
+    g++ -shared kernels.o gemm.o -o libcpdgemm.so $CXXFLAGS || exit 1
+    echo "Compiling the program..."
+    g++ multiplication.cpp -o multiplication $CXXFLAGS -DCPD_BUILD_FLAGS="\"$CXXFLAGS\"" libcpdgemm.a -lpapi || exit 1
+fi
+
+# MPI=1 also builds multiplication_mpi, which adds mode 12 (SUMMA over MPI
+# ranks); run it under mpirun, e.g. mpirun -np 4 ./multiplication_mpi summa 8192 3 1
+if [ "$MPI" == "1" ] && [ ! -f ./multiplication_mpi ]; then
+    echo "Compiling the MPI program..."
+    mpicxx -c summa.cpp -o summa.o $CXXFLAGS -DCPD_MPI || exit 1
+    mpicxx multiplication.cpp summa.o -o multiplication_mpi $CXXFLAGS -DCPD_MPI -DCPD_BUILD_FLAGS="\"$CXXFLAGS -DCPD_MPI\"" libcpdgemm.a -lpapi || exit 1
+fi
+
+# BUILD_ONLY=1 stops after the build (regression.py uses it).
+if [ "$BUILD_ONLY" == "1" ]; then
+    exit 0
+fi
+
 # Arguments
 MODES_RAW=$1  # Can be a single number or a list [1,2,3]
 ITER=$2       # Number of iterations
-PN=$3         # "p1" or "p2" for parallel, "n" for normal (only for mode 2)
-BLOCK_SIZE=$4 # Block size (only for mode 3)
+PN=$3         # "p1" or "p2" for parallel, "n" for normal (mode 2); "p1" or "n" (modes 3, 5 and 6)
+BLOCK_SIZE=$4 # Block size (only for mode 3): n, MBxKBxNB, or "auto" to use/create the tuning cache
+WARMUP=${WARMUP:-1} # Untimed iterations before the timed ones (environment override)
 
 # Remove brackets from the modes list and convert to an array
 MODES=$(echo "$MODES_RAW" | tr -d '[]' | tr ',' ' ')
 
 # Validations
 for MODE in $MODES; do
-    if [[ ! "$MODE" =~ ^[1-4]$ ]]; then
-        echo "Error: Mode must be 1, 2, 3, or 4."
+    if [[ ! "$MODE" =~ ^([1-6]|9)$ ]]; then
+        echo "Error: Mode must be 1, 2, 3, 4, 5, 6 or 9."
         exit 1
     fi
 done
@@ -35,20 +73,23 @@ if [[ "$MODES" =~ "2" ]]; then
     fi
 fi
 
-if [[ "$MODES" =~ "3" ]]; then
-    if [[ "$BLOCK_SIZE" != "128" && "$BLOCK_SIZE" != "256" && "$BLOCK_SIZE" != "512" ]]; then
-        echo "Error: Mode 3 requires a block_size of 128, 256, or 512."
+if [[ "$MODES" =~ "3" || "$MODES" =~ "5" || "$MODES" =~ "6" || "$MODES" =~ "9" ]]; then
+    if [[ -n "$PN" && "$PN" != "p1" && "$PN" != "n" ]]; then
+        echo "Error: Modes 3, 5, 6 and 9 accept 'p1' for parallel or 'n' for normal."
         exit 1
     fi
 fi
 
-# Compile the program if necessary
-EXECUTABLE="./multiplication"
-if [ ! -f "$EXECUTABLE" ]; then
-    echo "Compiling the program..."
-    g++ multiplication.cpp -o multiplication -O2 -fopenmp -lpapi
+if [[ "$MODES" =~ "3" ]]; then
+    if [[ ! "$BLOCK_SIZE" =~ ^[1-9][0-9]*(x[1-9][0-9]*x[1-9][0-9]*)?$ && "$BLOCK_SIZE" != "auto" ]]; then
+        echo "Error: Mode 3 requires a block_size (e.g. 256 or 128x256x512) or 'auto'."
+        exit 1
+    fi
 fi
 
+# Every run is also appended, with its metadata, to one JSON-lines store
+RESULTS_STORE=${RESULTS_STORE:-results.jsonl}
+
 # Determine the next test number and create the main test directory if it doesn't exist
 if [ -z "$TEST_DIR" ]; then
     TEST_PREFIX="test_"
@@ -65,14 +106,20 @@ fi
 # If mode is 4, execute all tests
 if [ "$MODE" -eq 4 ]; then
     echo "Executing all tests with $ITER iterations..."
-    for TEST_MODE in 1 2 3; do
+    for TEST_MODE in 1 2 3 5 6 9; do
         if [ "$TEST_MODE" -eq 2 ]; then
             for PARALLEL in "n" "pi" "po"; do
                 TEST_DIR="$TEST_DIR" $0 $TEST_MODE $ITER $PARALLEL_TYPE
             done
         elif [ "$TEST_MODE" -eq 3 ]; then
-            for BLOCK in 128 256 512; do
-                TEST_DIR="$TEST_DIR" $0 $TEST_MODE $ITER "" $BLOCK
+            for BLOCK in 128 256 512 auto; do
+                for PARALLEL in "n" "p1"; do
+                    TEST_DIR="$TEST_DIR" $0 $TEST_MODE $ITER $PARALLEL $BLOCK
+                done
+            done
+        elif [ "$TEST_MODE" -eq 5 ] || [ "$TEST_MODE" -eq 6 ] || [ "$TEST_MODE" -eq 9 ]; then
+            for PARALLEL in "n" "p1"; do
+                TEST_DIR="$TEST_DIR" $0 $TEST_MODE $ITER $PARALLEL
             done
         else
             TEST_DIR="$TEST_DIR" $0 $TEST_MODE $ITER
@@ -84,9 +131,11 @@ fi
 # Execute the specified modes
 for MODE in $MODES; do
 
-    # Define the parallel flag (applies only to mode 2)
+    # Define the parallel flag (applies to modes 2 and 3)
     PARALLEL_FLAG=0
-    if [[ "$MODE" -eq 2 ]]; then
+    if [[ ( "$MODE" -eq 3 || "$MODE" -eq 5 || "$MODE" -eq 6 || "$MODE" -eq 9 ) && "$PN" == "p1" ]]; then
+        PARALLEL_FLAG=1
+    elif [[ "$MODE" -eq 2 ]]; then
         if [ "$PN" == "p1" ]; then
             PARALLEL_FLAG=1
         elif [ "$PN" == "p2" ]; then 
@@ -108,7 +157,29 @@ for MODE in $MODES; do
             SUBDIR="line_normal"
         fi
     elif [[ "$MODE" -eq 3 ]]; then
-        SUBDIR="block_${BLOCK_SIZE}"
+        if [ "$PARALLEL_FLAG" -eq 1 ]; then
+            SUBDIR="block_parallel_${BLOCK_SIZE}"
+        else
+            SUBDIR="block_${BLOCK_SIZE}"
+        fi
+    elif [[ "$MODE" -eq 5 ]]; then
+        if [ "$PARALLEL_FLAG" -eq 1 ]; then
+            SUBDIR="packed_parallel"
+        else
+            SUBDIR="packed"
+        fi
+    elif [[ "$MODE" -eq 6 ]]; then
+        if [ "$PARALLEL_FLAG" -eq 1 ]; then
+            SUBDIR="dot_parallel"
+        else
+            SUBDIR="dot"
+        fi
+    elif [[ "$MODE" -eq 9 ]]; then
+        if [ "$PARALLEL_FLAG" -eq 1 ]; then
+            SUBDIR="recursive_parallel"
+        else
+            SUBDIR="recursive"
+        fi
     else
         echo "Invalid mode!"
         exit 1
@@ -120,7 +191,7 @@ for MODE in $MODES; do
 
     # List of matrix sizes
     MATRIX_SIZES=(600 1000 1400 1800 2200 2600 3000)
-    if [ "$MODE" -eq 2 ] || [ "$MODE" -eq 3 ]; then
+    if [ "$MODE" -eq 2 ] || [ "$MODE" -eq 3 ] || [ "$MODE" -eq 5 ] || [ "$MODE" -eq 6 ] || [ "$MODE" -eq 9 ]; then
         MATRIX_SIZES+=(4096 6144 8192 10240)
     fi
 
@@ -131,27 +202,16 @@ for MODE in $MODES; do
         OUTPUT_FILE="$OUTPUT_DIR/results.csv"
 
         echo "Executing mode=$MODE for matrix size $SIZE with $ITER iterations..."
-        # Remove previous output file, if it exists
-        rm -f "$OUTPUT_FILE"
-
-        # For each iteration, run the executable with dummy iteration parameter = 1
-        for ((i=1; i<=ITER; i++)); do
-            echo "Iteration $i..."
-            if [[ "$MODE" -eq 3 ]]; then
-                if [ $i -eq 1 ]; then
-                    $EXECUTABLE $MODE $SIZE 1 $PARALLEL_FLAG $BLOCK_SIZE > temp_results.csv
-                else
-                    $EXECUTABLE $MODE $SIZE 1 $PARALLEL_FLAG $BLOCK_SIZE | tail -n +2 >> temp_results.csv
-                fi
-            else
-                if [ $i -eq 1 ]; then
-                    $EXECUTABLE $MODE $SIZE 1 $PARALLEL_FLAG > temp_results.csv
-                else
-                    $EXECUTABLE $MODE $SIZE 1 $PARALLEL_FLAG | tail -n +2 >> temp_results.csv
-                fi
-            fi
-        done
-        mv temp_results.csv "$OUTPUT_FILE"
+
+        # The binary runs the warmup and all timed iterations in-process on the same
+        # buffers and reports min/median/mean/stddev/p95 for each metric.
+        if [[ "$MODE" -eq 3 && "$BLOCK_SIZE" == "auto" ]]; then
+            $EXECUTABLE $MODE $SIZE $ITER $PARALLEL_FLAG --autotune --warmup=$WARMUP --results="$RESULTS_STORE" > "$OUTPUT_FILE"
+        elif [[ "$MODE" -eq 3 ]]; then
+            $EXECUTABLE $MODE $SIZE $ITER $PARALLEL_FLAG $BLOCK_SIZE --warmup=$WARMUP --results="$RESULTS_STORE" > "$OUTPUT_FILE"
+        else
+            $EXECUTABLE $MODE $SIZE $ITER $PARALLEL_FLAG --warmup=$WARMUP --results="$RESULTS_STORE" > "$OUTPUT_FILE"
+        fi
         echo "Results saved in $OUTPUT_FILE"
     done
 
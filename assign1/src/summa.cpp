@@ -0,0 +1,123 @@
+#include "summa.h"
+
+#include <chrono>
+#include <future>
+
+using namespace chrono;
+
+// SUMMA (van de Geijn and Watts): C(r, c) += A(r, k) * B(k, c) for each K
+// panel k, with A(r, k) broadcast along process row r and B(k, c) down
+// process column c. A panel never straddles two owners: it stops at the next
+// column block boundary of A and the next row block boundary of B.
+
+bool createSummaGrid(MPI_Comm world, idx_t M, idx_t N, idx_t K, SummaGrid &g) {
+    g.world = world;
+    MPI_Comm_rank(world, &g.rank);
+    MPI_Comm_size(world, &g.ranks);
+    int dims[2] = {0, 0};
+    MPI_Dims_create(g.ranks, 2, dims);
+    g.rows = dims[0];
+    g.cols = dims[1];
+    if (M < g.rows || N < g.cols || K < max(g.rows, g.cols)) {
+        if (g.rank == 0) cerr << "The matrices are too small for a " << g.rows << "x" << g.cols << " process grid." << endl;
+        return false;
+    }
+    g.myRow = g.rank / g.cols;
+    g.myCol = g.rank % g.cols;
+    // The rank within the row communicator is the grid column and vice versa.
+    MPI_Comm_split(world, g.myRow, g.myCol, &g.row);
+    MPI_Comm_split(world, g.myCol, g.myRow, &g.col);
+
+    g.M = M;
+    g.N = N;
+    g.K = K;
+    g.m0 = summaOffset(M, g.rows, g.myRow);
+    g.m = summaOffset(M, g.rows, g.myRow + 1) - g.m0;
+    g.n0 = summaOffset(N, g.cols, g.myCol);
+    g.n = summaOffset(N, g.cols, g.myCol + 1) - g.n0;
+    g.ka0 = summaOffset(K, g.cols, g.myCol);
+    g.ka = summaOffset(K, g.cols, g.myCol + 1) - g.ka0;
+    g.kb0 = summaOffset(K, g.rows, g.myRow);
+    g.kb = summaOffset(K, g.rows, g.myRow + 1) - g.kb0;
+    return true;
+}
+
+void freeSummaGrid(SummaGrid &g) {
+    MPI_Comm_free(&g.row);
+    MPI_Comm_free(&g.col);
+}
+
+struct SummaPanel {
+    idx_t k, width;
+    int colOwner, rowOwner;
+};
+
+// The K panels in order, split at every block boundary of A's columns and B's rows.
+vector<SummaPanel> summaPanels(const SummaGrid &g, idx_t panel) {
+    vector<SummaPanel> panels;
+    int c = 0, r = 0;
+    for (idx_t k = 0; k < g.K;) {
+        while (summaOffset(g.K, g.cols, c + 1) <= k) c++;
+        while (summaOffset(g.K, g.rows, r + 1) <= k) r++;
+        idx_t width = min({panel, summaOffset(g.K, g.cols, c + 1) - k, summaOffset(g.K, g.rows, r + 1) - k});
+        panels.push_back({k, width, c, r});
+        k += width;
+    }
+    return panels;
+}
+
+SummaTimes OnMultSumma(const SummaGrid &g, idx_t panel, const double *A, const double *B, double *C, bool overlap) {
+    SummaTimes t = {0.0, 0.0, 0.0};
+    vector<SummaPanel> panels = summaPanels(g, panel);
+
+    // The owner copies its strided A columns into the buffer; B rows are
+    // contiguous, so the owner broadcasts them in place.
+    double *Abuf[2], *Bbuf[2];
+    const double *Bpanel[2];
+    for (int s = 0; s < 2; s++) {
+        Abuf[s] = allocMatrix((size_t)max<idx_t>(g.m * panel, 1), false);
+        Bbuf[s] = allocMatrix((size_t)max<idx_t>(panel * g.n, 1), false);
+    }
+
+    // Returns the seconds spent broadcasting panel p into slot.
+    auto fetch = [&](size_t p, int slot) {
+        auto start = high_resolution_clock::now();
+        const SummaPanel &q = panels[p];
+        if (g.myCol == q.colOwner) {
+            for (idx_t i = 0; i < g.m; i++) {
+                memcpy(&Abuf[slot][i * q.width], &A[i * g.ka + q.k - g.ka0], q.width * sizeof(double));
+            }
+        }
+        MPI_Bcast(Abuf[slot], (int)(g.m * q.width), MPI_DOUBLE, q.colOwner, g.row);
+        double *Bdst = g.myRow == q.rowOwner ? const_cast<double *>(&B[(q.k - g.kb0) * g.n]) : Bbuf[slot];
+        MPI_Bcast(Bdst, (int)(q.width * g.n), MPI_DOUBLE, q.rowOwner, g.col);
+        Bpanel[slot] = Bdst;
+        return duration<double>(high_resolution_clock::now() - start).count();
+    };
+
+    future<double> next;
+    if (overlap) next = async(launch::async, fetch, 0, 0);
+    for (size_t p = 0; p < panels.size(); p++) {
+        int slot = p & 1;
+        if (overlap) {
+            auto start = high_resolution_clock::now();
+            t.comm += next.get();
+            t.wait += duration<double>(high_resolution_clock::now() - start).count();
+            if (p + 1 < panels.size()) next = async(launch::async, fetch, p + 1, slot ^ 1);
+        } else {
+            double comm = fetch(p, slot);
+            t.comm += comm;
+            t.wait += comm;
+        }
+
+        auto start = high_resolution_clock::now();
+        gemm(g.m, g.n, panels[p].width, 1.0, Abuf[slot], panels[p].width, Bpanel[slot], g.n, p == 0 ? 0.0 : 1.0, C, g.n);
+        t.compute += duration<double>(high_resolution_clock::now() - start).count();
+    }
+
+    for (int s = 0; s < 2; s++) {
+        freeMatrix(Abuf[s]);
+        freeMatrix(Bbuf[s]);
+    }
+    return t;
+}
@@ -0,0 +1,41 @@
+#ifndef CPD_SUMMA_H
+#define CPD_SUMMA_H
+
+// Distributed SUMMA on a 2D process grid (built with -DCPD_MPI). A, B and C are
+// split into grid rows x grid cols blocks: rank (r, c) holds rows m0.. of A and
+// C, columns n0.. of B and C, the K columns ka0.. of A (split over the grid
+// columns) and the K rows kb0.. of B (split over the grid rows). Every K panel
+// is broadcast along the process rows (from the owner of its A columns) and
+// down the process columns (from the owner of its B rows), and each rank adds
+// the product of the two panels into its block of C with gemm().
+
+#include <mpi.h>
+#include "kernels.h"
+
+struct SummaGrid {
+    MPI_Comm world, row, col;
+    int rank, ranks, rows, cols, myRow, myCol;
+    idx_t M, N, K;
+    idx_t m0, m, n0, n, ka0, ka, kb0, kb;
+};
+
+// First index of part p when n is split into parts near-equal blocks.
+inline idx_t summaOffset(idx_t n, int parts, int p) { return n * p / parts; }
+
+// Time one rank spent in its local kernel, blocked waiting for a panel, and
+// broadcasting panels (on the helper thread when communication overlaps).
+struct SummaTimes {
+    double compute, wait, comm;
+};
+
+// Builds the most square grid for the ranks of world (MPI_Dims_create).
+bool createSummaGrid(MPI_Comm world, idx_t M, idx_t N, idx_t K, SummaGrid &g);
+void freeSummaGrid(SummaGrid &g);
+
+// C = A * B on the local blocks (row-major, leading dimensions ka, n and n).
+// Panels are at most panel wide. With overlap the next panel is broadcast on a
+// helper thread while the current one is multiplied, which needs at least
+// MPI_THREAD_SERIALIZED; otherwise each broadcast completes before its product.
+SummaTimes OnMultSumma(const SummaGrid &g, idx_t panel, const double *A, const double *B, double *C, bool overlap);
+
+#endif